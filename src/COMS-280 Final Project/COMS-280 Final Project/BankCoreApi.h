@@ -0,0 +1,110 @@
+#ifndef BANK_CORE_API_H
+#define BANK_CORE_API_H
+
+/**
+ * Stable C interface to the bank core, for callers in other languages.
+ *
+ * Work is submitted in batches: an array of operations goes in, and a matching
+ * array of results comes out. Both arrays are owned by the caller, and the
+ * library keeps no pointer to them after the call returns. A batch takes the
+ * core's lock once, so the per-call costs of crossing the FFI boundary and
+ * locking are shared by every operation in it.
+ *
+ * Amounts are signed integer cents. Account ids are the ids returned by
+ * bank_core_open_account.
+ *
+ * BankOperation and BankResult are passed as arrays, so their size is the array
+ * stride and part of the ABI: both layouts are permanently fixed at 24 bytes and
+ * will never grow. The reserved fields must be zero; a later version may give them
+ * a meaning that zero keeps switched off. Anything that needs more room gets new
+ * structs and a new entry point beside these, and BANK_CORE_API_VERSION goes up
+ * when entry points are added. Existing functions keep their meaning.
+ *
+ * To build the core as a library without the console program, define
+ * BANKING_CORE_LIBRARY when compiling Banking_System.cpp.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(BANKING_CORE_LIBRARY)
+#define BANK_CORE_API __declspec(dllexport)
+#elif defined(__GNUC__)
+#define BANK_CORE_API __attribute__((visibility("default")))
+#else
+#define BANK_CORE_API
+#endif
+
+#define BANK_CORE_API_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct BankCore BankCore;
+
+enum BankAccountKind {
+    BANK_ACCOUNT_SAVINGS = 0,
+    BANK_ACCOUNT_CHECKING = 1
+};
+
+enum BankOpCode {
+    BANK_OP_DEPOSIT = 0,
+    BANK_OP_WITHDRAW = 1,
+    BANK_OP_TRANSFER = 2,   /* from account to counterparty */
+    BANK_OP_BALANCE = 3,
+    BANK_OP_INTEREST = 4
+};
+
+enum BankStatus {
+    BANK_OK = 0,
+    BANK_DECLINED = 1,          /* insufficient funds or overdraft limit */
+    BANK_UNKNOWN_ACCOUNT = 2,
+    BANK_INVALID_REQUEST = 3,   /* unknown op code, non-positive amount, interest on checking */
+    BANK_INTERNAL_ERROR = 4
+};
+
+typedef struct BankOperation {
+    uint32_t op;             /* BankOpCode */
+    uint32_t account;
+    uint32_t counterparty;   /* transfers only */
+    uint32_t reserved;       /* must be zero */
+    int64_t amount_cents;
+} BankOperation;
+
+typedef struct BankResult {
+    int32_t status;          /* BankStatus */
+    uint32_t reserved;
+    uint64_t transaction_id; /* 0 when nothing was posted */
+    int64_t balance_cents;   /* the account's balance after the operation */
+} BankResult;
+
+/* Fails to compile where a compiler's packing would change the fixed layouts. */
+typedef char bank_operation_layout_check[sizeof(BankOperation) == 24 ? 1 : -1];
+typedef char bank_result_layout_check[sizeof(BankResult) == 24 ? 1 : -1];
+
+BANK_CORE_API uint32_t bank_core_api_version(void);
+
+/* Returns NULL when the core cannot be created. */
+BANK_CORE_API BankCore* bank_core_create(void);
+BANK_CORE_API void bank_core_destroy(BankCore* core);
+
+/* rate_or_limit is the interest rate in percent for savings, the overdraft limit in dollars for checking. */
+BANK_CORE_API int32_t bank_core_open_account(BankCore* core, int32_t kind, const char* owner,
+    int64_t balance_cents, double rate_or_limit, uint32_t* account_out);
+
+BANK_CORE_API size_t bank_core_account_count(const BankCore* core);
+
+/*
+ * Executes count operations in order and writes one result per operation.
+ * now is the posting time in seconds since the epoch. Returns the number of
+ * operations whose status is BANK_OK.
+ */
+BANK_CORE_API size_t bank_core_execute(BankCore* core, const BankOperation* operations, BankResult* results,
+    size_t count, int64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -5,8 +5,906 @@
 #include <sstream>
 #include <stdexcept>
 #include <functional>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <algorithm>
+#include <random>
+#include <atomic>
+#include <cctype>
+#include <mutex>
+#include <fstream>
+#include <cmath>
+#include <unordered_map>
+#include <cstring>
+#include <deque>
+#include <condition_variable>
+#include <exception>
+#include <cstdlib>
+#include <new>
+#include <cstddef>
+#include <type_traits>
+#include <limits>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <cerrno>
+#endif
+#include "BankCoreApi.h"
 using namespace std;
 
+/**
+ * Build-time instrumentation level, normally set per configuration in the project:
+ *   0  none: every surface compiles to nothing
+ *   1  production (Release default): Metrics counters and histograms only
+ *   2  diagnostic (Debug default): also trace spans, lock contention profiling
+ *      and allocation accounting
+ * Surfaces that are off are removed at compile time, not skipped at run time.
+ * BANKING_TRACK_ALLOCATIONS can still override allocation accounting on its own,
+ * except in a BANKING_CORE_LIBRARY build: replacing the global operator new and
+ * delete is a whole-program decision that belongs to the executable, not to a
+ * library loaded into someone else's process.
+ */
+#ifndef BANKING_INSTRUMENTATION
+#if defined(NDEBUG)
+#define BANKING_INSTRUMENTATION 1
+#else
+#define BANKING_INSTRUMENTATION 2
+#endif
+#endif
+
+#ifndef BANKING_TRACK_ALLOCATIONS
+#if defined(BANKING_CORE_LIBRARY)
+#define BANKING_TRACK_ALLOCATIONS 0
+#else
+#define BANKING_TRACK_ALLOCATIONS (BANKING_INSTRUMENTATION >= 2)
+#endif
+#elif BANKING_TRACK_ALLOCATIONS && defined(BANKING_CORE_LIBRARY)
+#error "BANKING_TRACK_ALLOCATIONS replaces the global operator new and cannot be used with BANKING_CORE_LIBRARY"
+#endif
+
+struct Instrumentation {
+    static constexpr int level = BANKING_INSTRUMENTATION;
+    static constexpr bool counters = level >= 1;
+    static constexpr bool spans = level >= 2;
+    static constexpr bool lockProfiling = level >= 2;
+    static constexpr bool allocations = BANKING_TRACK_ALLOCATIONS != 0;
+};
+
+/**
+ * Process-wide operational metrics in the Prometheus text exposition format.
+ * Counters and histograms live in per-thread blocks: each thread only ever writes
+ * its own block with relaxed loads and stores, so the hot path takes no lock and
+ * no atomic read-modify-write. A scrape sums every block under the registry mutex.
+ * A block outlives its thread and is handed to the next new thread, so totals
+ * never go backwards. Gauges are callbacks sampled at scrape time.
+ */
+class Metrics {
+public:
+    enum Counter {
+        Deposits, Withdrawals, Transfers, InterestPostings, FeePostings, Reversals, BulkPostings,
+        Declines, LookupHits, LookupMisses, LockWaits, CounterCount
+    };
+    enum Histogram { LockWaitNanos, BulkBatchSize, HistogramCount };
+    static constexpr int bucketCount = 32;  // bucket i counts values below 2^i; the last is +Inf
+
+    static void count(Counter counter, uint64_t n = 1) {
+        if (!Instrumentation::counters)
+            return;
+        atomic<uint64_t>& value = local().counters[counter];
+        value.store(value.load(memory_order_relaxed) + n, memory_order_relaxed);
+    }
+
+    static void observe(Histogram histogram, uint64_t value) {
+        if (!Instrumentation::counters)
+            return;
+        Block& block = local();
+        int bucket = 0;
+        while (bucket < bucketCount - 1 && (value >> bucket) != 0)
+            ++bucket;
+        atomic<uint64_t>& hits = block.buckets[histogram][bucket];
+        hits.store(hits.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        block.sums[histogram].store(block.sums[histogram].load(memory_order_relaxed) + value, memory_order_relaxed);
+    }
+
+    // Registers a gauge such as "bank_queue_depth{queue=\"parsed\"}"; returns its handle
+    static size_t addGauge(const string& name, const string& help, function<double()> sample) {
+        Registry& registry = instance();
+        lock_guard<mutex> lock(registry.guard);
+        registry.gauges.push_back({ registry.nextGauge, name, help, move(sample) });
+        return registry.nextGauge++;
+    }
+
+    static void removeGauge(size_t handle) {
+        Registry& registry = instance();
+        lock_guard<mutex> lock(registry.guard);
+        auto& gauges = registry.gauges;
+        gauges.erase(remove_if(gauges.begin(), gauges.end(), [&](const Gauge& g) { return g.handle == handle; }), gauges.end());
+    }
+
+    static uint64_t total(Counter counter) {
+        Registry& registry = instance();
+        lock_guard<mutex> lock(registry.guard);
+        uint64_t sum = 0;
+        for (const auto& block : registry.blocks)
+            sum += block->counters[counter].load(memory_order_relaxed);
+        return sum;
+    }
+
+    static void render(ostream& out) {
+        Registry& registry = instance();
+        lock_guard<mutex> lock(registry.guard);
+        uint64_t counters[CounterCount] = {};
+        uint64_t buckets[HistogramCount][bucketCount] = {};
+        uint64_t sums[HistogramCount] = {};
+        for (const auto& block : registry.blocks) {
+            for (int c = 0; c < CounterCount; ++c)
+                counters[c] += block->counters[c].load(memory_order_relaxed);
+            for (int h = 0; h < HistogramCount; ++h) {
+                for (int b = 0; b < bucketCount; ++b)
+                    buckets[h][b] += block->buckets[h][b].load(memory_order_relaxed);
+                sums[h] += block->sums[h].load(memory_order_relaxed);
+            }
+        }
+
+        static const char* const ops[] = { "deposit", "withdraw", "transfer", "interest", "fee", "reversal", "bulk" };
+        out << "# HELP bank_operations_total Postings by operation type.\n# TYPE bank_operations_total counter\n";
+        for (int c = Deposits; c <= BulkPostings; ++c)
+            out << "bank_operations_total{op=\"" << ops[c] << "\"} " << counters[c] << "\n";
+        out << "# HELP bank_declines_total Operations refused by balance or overdraft rules.\n# TYPE bank_declines_total counter\n"
+            << "bank_declines_total " << counters[Declines] << "\n"
+            << "# HELP bank_customer_lookups_total Customer lookups by name.\n# TYPE bank_customer_lookups_total counter\n"
+            << "bank_customer_lookups_total{result=\"hit\"} " << counters[LookupHits] << "\n"
+            << "bank_customer_lookups_total{result=\"miss\"} " << counters[LookupMisses] << "\n"
+            << "# HELP bank_lock_waits_total Account lock acquisitions that had to block.\n# TYPE bank_lock_waits_total counter\n"
+            << "bank_lock_waits_total " << counters[LockWaits] << "\n";
+
+        static const char* const histograms[][2] = {
+            { "bank_lock_wait_nanoseconds", "Time blocked acquiring a contended account lock." },
+            { "bank_bulk_post_batch_size", "Postings per bulk posting batch." } };
+        for (int h = 0; h < HistogramCount; ++h) {
+            const char* name = histograms[h][0];
+            out << "# HELP " << name << " " << histograms[h][1] << "\n# TYPE " << name << " histogram\n";
+            uint64_t cumulative = 0;
+            for (int b = 0; b < bucketCount; ++b) {
+                cumulative += buckets[h][b];
+                out << name << "_bucket{le=\"";
+                if (b == bucketCount - 1) out << "+Inf";
+                else out << (uint64_t(1) << b) - 1;
+                out << "\"} " << cumulative << "\n";
+            }
+            out << name << "_sum " << sums[h] << "\n" << name << "_count " << cumulative << "\n";
+        }
+
+        string lastFamily;
+        for (const auto& gauge : registry.gauges) {
+            string family = gauge.name.substr(0, gauge.name.find('{'));
+            if (family != lastFamily)
+                out << "# HELP " << family << " " << gauge.help << "\n# TYPE " << family << " gauge\n";
+            lastFamily = family;
+            out << gauge.name << " " << gauge.sample() << "\n";
+        }
+    }
+
+private:
+    struct Block {
+        atomic<uint64_t> counters[CounterCount];
+        atomic<uint64_t> buckets[HistogramCount][bucketCount];
+        atomic<uint64_t> sums[HistogramCount];
+
+        Block() {
+            for (auto& counter : counters) counter.store(0, memory_order_relaxed);
+            for (auto& histogram : buckets)
+                for (auto& bucket : histogram) bucket.store(0, memory_order_relaxed);
+            for (auto& sum : sums) sum.store(0, memory_order_relaxed);
+        }
+    };
+
+    struct Gauge {
+        size_t handle;
+        string name;
+        string help;
+        function<double()> sample;
+    };
+
+    struct Registry {
+        mutex guard;
+        vector<unique_ptr<Block>> blocks;
+        vector<Block*> spare;
+        vector<Gauge> gauges;
+        size_t nextGauge = 0;
+    };
+
+    // Claims a block for the calling thread and returns it to the spare list on thread exit
+    struct ThreadSlot {
+        Block* block;
+
+        ThreadSlot() {
+            Registry& registry = instance();
+            lock_guard<mutex> lock(registry.guard);
+            if (registry.spare.empty()) {
+                registry.blocks.push_back(make_unique<Block>());
+                block = registry.blocks.back().get();
+            }
+            else {
+                block = registry.spare.back();
+                registry.spare.pop_back();
+            }
+        }
+
+        ~ThreadSlot() {
+            Registry& registry = instance();
+            lock_guard<mutex> lock(registry.guard);
+            registry.spare.push_back(block);
+        }
+    };
+
+    static Registry& instance() {
+        static Registry registry;
+        return registry;
+    }
+
+    static Block& local() {
+        thread_local ThreadSlot slot;
+        return *slot.block;
+    }
+};
+
+constexpr int Metrics::bucketCount;
+
+/**
+ * Scoped gauge registration, for gauges that sample an object with a shorter life
+ * than the process, such as a pipeline's queues.
+ */
+class MetricsGauge {
+private:
+    size_t handle;
+
+public:
+    MetricsGauge(const string& name, const string& help, function<double()> sample)
+        : handle(Metrics::addGauge(name, help, move(sample))) {
+    }
+    ~MetricsGauge() { Metrics::removeGauge(handle); }
+    MetricsGauge(const MetricsGauge&) = delete;
+    MetricsGauge& operator=(const MetricsGauge&) = delete;
+};
+
+/**
+ * Writes the metrics to a file on a background thread every few seconds, for the
+ * Prometheus node_exporter textfile collector. Each write goes to a temporary file
+ * that then replaces the target, so the collector never reads a partial scrape.
+ */
+class MetricsFileWriter {
+private:
+    string path;
+    chrono::milliseconds interval;
+    mutex guard;
+    condition_variable wake;
+    bool stopping = false;
+    thread worker;
+
+public:
+    MetricsFileWriter(const string& file, double seconds = 5.0)
+        : path(file), interval(static_cast<int64_t>(max(0.1, seconds) * 1000)) {
+        worker = thread([this]() {
+            unique_lock<mutex> lock(guard);
+            while (!stopping) {
+                wake.wait_for(lock, interval, [this]() { return stopping; });
+                writeOnce();
+            }
+        });
+    }
+
+    ~MetricsFileWriter() {
+        {
+            lock_guard<mutex> lock(guard);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+
+    MetricsFileWriter(const MetricsFileWriter&) = delete;
+    MetricsFileWriter& operator=(const MetricsFileWriter&) = delete;
+
+    void writeOnce() const {
+        string temporary = path + ".tmp";
+        {
+            ofstream out(temporary, ios::trunc);
+            if (!out)
+                return;
+            Metrics::render(out);
+        }
+#if defined(_WIN32)
+        MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+        rename(temporary.c_str(), path.c_str());
+#endif
+    }
+};
+
+/**
+ * Optional operation timelines in the Chrome trace-event format (chrome://tracing,
+ * Perfetto). Each thread appends completed spans to its own ring buffer, allocated
+ * on its first span, so recording takes no lock; when a buffer wraps, the oldest
+ * spans are overwritten. While tracing is off a span costs one relaxed load and a
+ * branch. Dump after the traced threads have finished or gone quiet: a thread that
+ * is still writing can overwrite a span while it is being dumped.
+ */
+class SpanTracer {
+public:
+    static bool enabled() { return on.load(memory_order_relaxed); }
+
+    static void enable(size_t eventsPerThread = 1 << 16) {
+        Registry& registry = instance();
+        {
+            lock_guard<mutex> lock(registry.guard);
+            size_t capacity = 1;
+            while (capacity < eventsPerThread) capacity <<= 1;
+            registry.capacity = capacity;
+        }
+        on.store(true, memory_order_relaxed);
+    }
+
+    static void disable() { on.store(false, memory_order_relaxed); }
+
+    static uint64_t now() {
+        return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    static void record(const char* name, uint64_t begin, uint64_t end) {
+        Buffer& buffer = local();
+        uint64_t written = buffer.written.load(memory_order_relaxed);
+        buffer.events[written & (buffer.events.size() - 1)] = { name, begin, end };
+        buffer.written.store(written + 1, memory_order_release);
+    }
+
+    static void dump(ostream& out) {
+        Registry& registry = instance();
+        lock_guard<mutex> lock(registry.guard);
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        for (const auto& buffer : registry.buffers) {
+            uint64_t written = buffer->written.load(memory_order_acquire);
+            uint64_t size = buffer->events.size();
+            for (uint64_t i = written > size ? written - size : 0; i < written; ++i) {
+                const Event& event = buffer->events[i & (size - 1)];
+                out << (first ? "\n" : ",\n") << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                    << buffer->tid << ",\"ts\":" << event.begin / 1000 << "." << setw(3) << setfill('0') << event.begin % 1000
+                    << ",\"dur\":" << (event.end - event.begin) / 1000 << "." << setw(3) << (event.end - event.begin) % 1000
+                    << setfill(' ') << "}";
+                first = false;
+            }
+        }
+        out << "\n]}\n";
+    }
+
+    // Drops every recorded span; only call while no traced thread is running
+    static void clear() {
+        Registry& registry = instance();
+        lock_guard<mutex> lock(registry.guard);
+        for (auto& buffer : registry.buffers)
+            buffer->written.store(0, memory_order_relaxed);
+    }
+
+private:
+    struct Event {
+        const char* name;
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    struct Buffer {
+        uint32_t tid;
+        vector<Event> events;
+        atomic<uint64_t> written;
+
+        Buffer(uint32_t thread, size_t capacity) : tid(thread), events(capacity), written(0) {}
+    };
+
+    struct Registry {
+        mutex guard;
+        vector<unique_ptr<Buffer>> buffers;
+        size_t capacity = 1 << 16;
+    };
+
+    static atomic<bool> on;
+
+    static Registry& instance() {
+        static Registry registry;
+        return registry;
+    }
+
+    static Buffer& local() {
+        thread_local Buffer* buffer = nullptr;
+        if (!buffer) {
+            Registry& registry = instance();
+            lock_guard<mutex> lock(registry.guard);
+            registry.buffers.push_back(make_unique<Buffer>(static_cast<uint32_t>(registry.buffers.size() + 1), registry.capacity));
+            buffer = registry.buffers.back().get();
+        }
+        return *buffer;
+    }
+};
+
+atomic<bool> SpanTracer::on(false);
+
+/**
+ * Traces for as long as it lives and writes the timeline to a file when destroyed.
+ */
+class SpanTraceFile {
+private:
+    string path;
+
+public:
+    explicit SpanTraceFile(const string& file) : path(file) {
+        if (!Instrumentation::spans)
+            cerr << "Trace spans are compiled out at instrumentation level " << Instrumentation::level << "\n";
+        SpanTracer::enable();
+    }
+
+    ~SpanTraceFile() {
+        SpanTracer::disable();
+        ofstream out(path, ios::trunc);
+        if (out)
+            SpanTracer::dump(out);
+    }
+
+    SpanTraceFile(const SpanTraceFile&) = delete;
+    SpanTraceFile& operator=(const SpanTraceFile&) = delete;
+};
+
+/**
+ * Records the enclosing scope as one span when tracing was on at its start.
+ * The name must be a string literal, since only the pointer is stored.
+ * Builds without spans use the empty specialization, which compiles to nothing.
+ */
+template <bool Compiled>
+class BasicScopedSpan {
+private:
+    const char* name;
+    uint64_t begin;
+
+public:
+    explicit BasicScopedSpan(const char* spanName) : name(spanName), begin(SpanTracer::enabled() ? SpanTracer::now() : 0) {}
+
+    ~BasicScopedSpan() {
+        if (begin)
+            SpanTracer::record(name, begin, SpanTracer::now());
+    }
+
+    BasicScopedSpan(const BasicScopedSpan&) = delete;
+    BasicScopedSpan& operator=(const BasicScopedSpan&) = delete;
+};
+
+template <>
+class BasicScopedSpan<false> {
+public:
+    explicit BasicScopedSpan(const char*) {}
+    BasicScopedSpan(const BasicScopedSpan&) = delete;
+    BasicScopedSpan& operator=(const BasicScopedSpan&) = delete;
+};
+
+using ScopedSpan = BasicScopedSpan<Instrumentation::spans>;
+
+/**
+ * Allocation accounting. With BANKING_TRACK_ALLOCATIONS (on in diagnostic builds of
+ * the program, never in the library), the global operator new and delete are replaced by thin malloc/free wrappers that
+ * bump plain thread_local counters: no lock, no atomic, and nothing that could
+ * allocate. Counts are per thread; work handed to other threads is not included.
+ */
+struct AllocationCounters {
+    uint64_t allocations;
+    uint64_t bytes;
+    uint64_t frees;
+};
+
+inline AllocationCounters& threadAllocations() {
+    static thread_local AllocationCounters counters = { 0, 0, 0 };
+    return counters;
+}
+
+#if BANKING_TRACK_ALLOCATIONS
+static void* trackedAllocate(size_t size) {
+    AllocationCounters& counters = threadAllocations();
+    ++counters.allocations;
+    counters.bytes += size;
+    for (;;) {
+        if (void* block = malloc(size ? size : 1))
+            return block;
+        new_handler handler = get_new_handler();
+        if (!handler)
+            throw bad_alloc();
+        handler();
+    }
+}
+
+static void trackedFree(void* block) noexcept {
+    if (!block)
+        return;
+    ++threadAllocations().frees;
+    free(block);
+}
+
+void* operator new(size_t size) { return trackedAllocate(size); }
+void* operator new[](size_t size) { return trackedAllocate(size); }
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    try { return trackedAllocate(size); }
+    catch (...) { return nullptr; }
+}
+void* operator new[](size_t size, const nothrow_t&) noexcept {
+    try { return trackedAllocate(size); }
+    catch (...) { return nullptr; }
+}
+void operator delete(void* block) noexcept { trackedFree(block); }
+void operator delete[](void* block) noexcept { trackedFree(block); }
+void operator delete(void* block, size_t) noexcept { trackedFree(block); }
+void operator delete[](void* block, size_t) noexcept { trackedFree(block); }
+void operator delete(void* block, const nothrow_t&) noexcept { trackedFree(block); }
+void operator delete[](void* block, const nothrow_t&) noexcept { trackedFree(block); }
+#endif
+
+/**
+ * Allocations made by the current thread since construction. A hot path can be
+ * pinned at zero with requireNone(), which throws when anything was allocated.
+ */
+class AllocationScope {
+private:
+    AllocationCounters start;
+
+public:
+    AllocationScope() : start(threadAllocations()) {}
+
+    static bool tracking() { return Instrumentation::allocations; }
+    uint64_t allocations() const { return threadAllocations().allocations - start.allocations; }
+    uint64_t bytes() const { return threadAllocations().bytes - start.bytes; }
+    uint64_t frees() const { return threadAllocations().frees - start.frees; }
+
+    void requireNone(const char* what) const {
+        if (tracking() && allocations() != 0)
+            throw logic_error(string(what) + " allocated " + to_string(allocations()) + " times");
+    }
+};
+
+/**
+ * In-process sampling profiler. On Linux, ITIMER_PROF raises SIGPROF for every
+ * 1/hz seconds of CPU the process consumes, in whichever thread is running; the
+ * handler only reserves a slot in a lock-free ring with a compare-and-swap and
+ * walks the frame-pointer chain from the interrupted context. backtrace() is not
+ * used because it re-enters the C++ unwinder, which crashes when the signal lands
+ * during a throw. The walk stays inside the stack bounds the thread recorded when
+ * it declared its ThreadClass, so it is safe without frame pointers; stacks are
+ * only complete when built with -fno-omit-frame-pointer. Threads without a class
+ * record just the interrupted function.
+ * A background thread drains the ring into folded stacks ("class;outer;...;inner
+ * count") per thread class; writeFolded() output feeds flamegraph.pl. Function
+ * names come from the dynamic symbol table, so link with -rdynamic; other frames
+ * print as module+offset. Other platforms get a no-op profiler whose start()
+ * returns false.
+ * The handler reads the thread's class and stack bounds from thread-local storage.
+ * In a shared library the default TLS model reaches a variable through
+ * __tls_get_addr, which may allocate the first time a thread touches the module,
+ * and that is not async-signal-safe. These variables use the initial-exec model,
+ * so the handler reads them at a fixed offset from the thread pointer. The
+ * restriction is that the library must be linked into the program or preloaded,
+ * not opened with dlopen() after startup: static TLS space for a module opened
+ * late is limited, and the load fails if it runs out.
+ */
+#if defined(__GNUC__)
+#define BANKING_SIGNAL_SAFE_TLS __attribute__((tls_model("initial-exec")))
+#else
+#define BANKING_SIGNAL_SAFE_TLS
+#endif
+
+class SamplingProfiler {
+public:
+    static constexpr int maxDepth = 48;
+
+    // Names the current thread's samples for as long as it lives; use a string literal
+    class ThreadClass {
+    private:
+        const char* previous;
+
+    public:
+        explicit ThreadClass(const char* name) : previous(currentClass) {
+            currentClass = name;
+#if defined(__linux__)
+            pthread_attr_t attributes;
+            void* base;
+            size_t size;
+            if (!stackHigh && pthread_getattr_np(pthread_self(), &attributes) == 0) {
+                if (pthread_attr_getstack(&attributes, &base, &size) == 0) {
+                    stackLow = reinterpret_cast<uintptr_t>(base);
+                    stackHigh = stackLow + size;
+                }
+                pthread_attr_destroy(&attributes);
+            }
+#endif
+        }
+        ~ThreadClass() { currentClass = previous; }
+        ThreadClass(const ThreadClass&) = delete;
+        ThreadClass& operator=(const ThreadClass&) = delete;
+    };
+
+    static uint64_t sampleCount() { return taken.load(memory_order_relaxed); }
+    static uint64_t droppedCount() { return dropped.load(memory_order_relaxed); }
+
+#if defined(__linux__)
+    static bool start(int hz = 100) {
+        State& state = instance();
+        lock_guard<mutex> lock(state.control);
+        if (state.running || hz <= 0)
+            return false;
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = onSignal;
+        action.sa_flags = SA_RESTART | SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGPROF, &action, &state.previousAction) != 0)
+            return false;
+        state.running = true;
+        state.drainer = thread([&state]() {
+            ThreadClass name("profiler");
+            unique_lock<mutex> lock(state.control);
+            while (state.running) {
+                state.wake.wait_for(lock, chrono::milliseconds(100));
+                drain(state);
+            }
+        });
+
+        itimerval timer;
+        long micros = max(1L, 1000000L / hz);
+        timer.it_interval.tv_sec = micros / 1000000;
+        timer.it_interval.tv_usec = micros % 1000000;
+        timer.it_value = timer.it_interval;
+        setitimer(ITIMER_PROF, &timer, nullptr);
+        return true;
+    }
+
+    static void stop() {
+        State& state = instance();
+        {
+            lock_guard<mutex> lock(state.control);
+            if (!state.running)
+                return;
+            itimerval off;
+            memset(&off, 0, sizeof(off));
+            setitimer(ITIMER_PROF, &off, nullptr);
+            state.running = false;
+        }
+        state.wake.notify_all();
+        state.drainer.join();
+        lock_guard<mutex> lock(state.control);
+        struct sigaction ignore;
+        memset(&ignore, 0, sizeof(ignore));
+        ignore.sa_handler = SIG_IGN;
+        sigaction(SIGPROF, &ignore, nullptr);  // a signal already in flight must not find the handler gone
+        drain(state);
+        sigaction(SIGPROF, &state.previousAction, nullptr);
+    }
+
+    static void writeFolded(ostream& out) {
+        State& state = instance();
+        lock_guard<mutex> lock(state.control);
+        drain(state);
+        unordered_map<uintptr_t, string> names;
+        auto nameOf = [&](uintptr_t address) -> const string& {
+            auto found = names.find(address);
+            if (found != names.end())
+                return found->second;
+            string name;
+            Dl_info info = {};
+            if (dladdr(reinterpret_cast<void*>(address), &info) && info.dli_sname) {
+                int status = 0;
+                char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+                name = status == 0 && demangled ? demangled : info.dli_sname;
+                free(demangled);
+            }
+            else if (info.dli_fname && address >= reinterpret_cast<uintptr_t>(info.dli_fbase)) {
+                const char* base = strrchr(info.dli_fname, '/');
+                ostringstream stream;
+                stream << (base ? base + 1 : info.dli_fname) << "+0x" << hex
+                    << address - reinterpret_cast<uintptr_t>(info.dli_fbase);
+                name = stream.str();
+            }
+            else {
+                name = "??";
+            }
+            replace(name.begin(), name.end(), ';', ':');
+            return names.emplace(address, name).first->second;
+        };
+        for (const auto& stack : state.stacks) {
+            out << stack.first.threadClass;
+            // Frames are innermost first; the folded format wants the root first
+            for (size_t i = stack.first.frames.size(); i > 0; --i)
+                out << ";" << nameOf(stack.first.frames[i - 1]);
+            out << " " << stack.second << "\n";
+        }
+    }
+#else
+    static bool start(int = 100) { return false; }
+    static void stop() {}
+    static void writeFolded(ostream&) {}
+#endif
+
+private:
+    static constexpr size_t capacity = 4096;
+
+    struct Slot {
+        atomic<uint32_t> ready;
+        const char* threadClass;
+        int depth;
+        void* frames[maxDepth];
+    };
+
+    struct StackKey {
+        string threadClass;
+        vector<uintptr_t> frames;
+
+        bool operator==(const StackKey& other) const { return threadClass == other.threadClass && frames == other.frames; }
+    };
+
+    struct StackHash {
+        size_t operator()(const StackKey& key) const {
+            size_t hash = std::hash<string>()(key.threadClass);
+            for (uintptr_t frame : key.frames)
+                hash = hash * 1099511628211ull ^ frame;
+            return hash;
+        }
+    };
+
+    struct State {
+        mutex control;
+        condition_variable wake;
+        thread drainer;
+        bool running = false;
+        unordered_map<StackKey, uint64_t, StackHash> stacks;
+#if defined(__linux__)
+        struct sigaction previousAction;
+#endif
+    };
+
+    static Slot slots[capacity];
+    static atomic<uint64_t> head;
+    static atomic<uint64_t> tail;
+    static atomic<uint64_t> taken;
+    static atomic<uint64_t> dropped;
+    static thread_local const char* currentClass BANKING_SIGNAL_SAFE_TLS;
+    static thread_local uintptr_t stackLow BANKING_SIGNAL_SAFE_TLS;
+    static thread_local uintptr_t stackHigh BANKING_SIGNAL_SAFE_TLS;
+
+    static State& instance() {
+        static State state;
+        return state;
+    }
+
+#if defined(__linux__)
+    static int walkStack(void* context, void** frames) {
+        const ucontext_t* interrupted = static_cast<const ucontext_t*>(context);
+#if defined(__x86_64__)
+        uintptr_t pc = static_cast<uintptr_t>(interrupted->uc_mcontext.gregs[REG_RIP]);
+        uintptr_t fp = static_cast<uintptr_t>(interrupted->uc_mcontext.gregs[REG_RBP]);
+        uintptr_t sp = static_cast<uintptr_t>(interrupted->uc_mcontext.gregs[REG_RSP]);
+#elif defined(__aarch64__)
+        uintptr_t pc = static_cast<uintptr_t>(interrupted->uc_mcontext.pc);
+        uintptr_t fp = static_cast<uintptr_t>(interrupted->uc_mcontext.regs[29]);
+        uintptr_t sp = static_cast<uintptr_t>(interrupted->uc_mcontext.sp);
+#else
+        (void)interrupted;
+        return 0;
+#endif
+        int depth = 0;
+        frames[depth++] = reinterpret_cast<void*>(pc);
+        // Each frame holds the caller's frame pointer and the return address above it
+        while (depth < maxDepth && fp >= sp && fp >= stackLow && fp + 2 * sizeof(uintptr_t) <= stackHigh
+            && fp % sizeof(uintptr_t) == 0) {
+            const uintptr_t* frame = reinterpret_cast<const uintptr_t*>(fp);
+            if (!frame[1])
+                break;
+            frames[depth++] = reinterpret_cast<void*>(frame[1]);
+            if (frame[0] <= fp)
+                break;
+            fp = frame[0];
+        }
+        return depth;
+    }
+
+    static void onSignal(int, siginfo_t*, void* context) {
+        int savedErrno = errno;
+        uint64_t index = head.load(memory_order_relaxed);
+        do {
+            if (index - tail.load(memory_order_acquire) >= capacity) {
+                dropped.fetch_add(1, memory_order_relaxed);
+                errno = savedErrno;
+                return;
+            }
+        } while (!head.compare_exchange_weak(index, index + 1, memory_order_acq_rel));
+        Slot& slot = slots[index % capacity];
+        slot.threadClass = currentClass ? currentClass : "other";
+        slot.depth = walkStack(context, slot.frames);
+        slot.ready.store(1, memory_order_release);
+        taken.fetch_add(1, memory_order_relaxed);
+        errno = savedErrno;
+    }
+#endif
+
+    // Folds ready slots in order; caller holds the control mutex
+    static void drain(State& state) {
+        uint64_t next = tail.load(memory_order_relaxed);
+        while (next < head.load(memory_order_acquire)) {
+            Slot& slot = slots[next % capacity];
+            if (!slot.ready.load(memory_order_acquire))
+                break;
+            StackKey key;
+            key.threadClass = slot.threadClass;
+            // Return addresses point past the call; step back into it
+            for (int i = 0; i < slot.depth; ++i)
+                key.frames.push_back(reinterpret_cast<uintptr_t>(slot.frames[i]) - (i > 0 ? 1 : 0));
+            ++state.stacks[key];
+            slot.ready.store(0, memory_order_relaxed);
+            tail.store(++next, memory_order_release);
+        }
+    }
+};
+
+constexpr int SamplingProfiler::maxDepth;
+constexpr size_t SamplingProfiler::capacity;
+SamplingProfiler::Slot SamplingProfiler::slots[SamplingProfiler::capacity];
+atomic<uint64_t> SamplingProfiler::head(0);
+atomic<uint64_t> SamplingProfiler::tail(0);
+atomic<uint64_t> SamplingProfiler::taken(0);
+atomic<uint64_t> SamplingProfiler::dropped(0);
+thread_local const char* SamplingProfiler::currentClass BANKING_SIGNAL_SAFE_TLS = nullptr;
+thread_local uintptr_t SamplingProfiler::stackLow BANKING_SIGNAL_SAFE_TLS = 0;
+thread_local uintptr_t SamplingProfiler::stackHigh BANKING_SIGNAL_SAFE_TLS = 0;
+
+/**
+ * Profiles for as long as it lives and writes folded stacks to a file when destroyed.
+ */
+class SamplingProfileFile {
+private:
+    string path;
+    bool started;
+
+public:
+    SamplingProfileFile(const string& file, int hz) : path(file), started(SamplingProfiler::start(hz)) {
+        if (!started)
+            cerr << "Sampling profiler is not available on this platform\n";
+    }
+
+    ~SamplingProfileFile() {
+        if (!started)
+            return;
+        SamplingProfiler::stop();
+        ofstream out(path, ios::trunc);
+        if (out)
+            SamplingProfiler::writeFolded(out);
+    }
+
+    SamplingProfileFile(const SamplingProfileFile&) = delete;
+    SamplingProfileFile& operator=(const SamplingProfileFile&) = delete;
+};
+
 /**
  * Utility class to handle interest calculation for savings accounts.
  */
@@ -47,16 +945,20 @@ protected:
     string owner;
     double balance;
     list<string> transactionHistory;
+    time_t lastActivity;
 
     // Helper method to format currency with two decimal places
     string formatAmount(double amount) const {
+        ScopedSpan span("formatAmount");
         ostringstream stream;
         stream << fixed << setprecision(2) << amount;
         return stream.str();
     }
 
 public:
-    BankAccount(string name, double initialBalance) : owner(name), balance(initialBalance) {}
+    BankAccount(string name, double initialBalance)
+        : owner(name), balance(initialBalance), lastActivity(time(nullptr)) {
+    }
     virtual ~BankAccount() = default;
 
     // Pure virtual methods to be implemented by derived classes
@@ -64,11 +966,14 @@ public:
     virtual void withdraw(double amount) = 0;
     virtual void display() const = 0;
 
+    // Every operation records a transaction, so this is also where activity is stamped
     void addTransaction(const string& transaction) {
         transactionHistory.push_back(transaction);
+        lastActivity = time(nullptr);
     }
 
     void displayTransactionHistory() const {
+        ScopedSpan span("displayTransactionHistory");
         cout << "Transaction History for " << owner << ":\n";
         for (const auto& transaction : transactionHistory) {
             cout << transaction << endl;
@@ -77,6 +982,7 @@ public:
 
     double getBalance() const { return balance; }
     string getOwner() const { return owner; }
+    time_t getLastActivity() const { return lastActivity; }
 };
 
 /**
@@ -93,24 +999,33 @@ public:
     }
 
     void deposit(double amount) override {
+        ScopedSpan span("deposit");
         balance += amount;
         addTransaction("Deposited: $" + formatAmount(amount));
+        Metrics::count(Metrics::Deposits);
     }
 
     void withdraw(double amount) override {
-        if (amount > balance)
+        ScopedSpan span("withdraw");
+        if (amount > balance) {
+            Metrics::count(Metrics::Declines);
             throw runtime_error("Insufficient funds");
+        }
         balance -= amount;
         addTransaction("Withdrawn: $" + formatAmount(amount));
+        Metrics::count(Metrics::Withdrawals);
     }
 
     void applyInterest() override {
+        ScopedSpan span("applyInterest");
         double interest = InterestCalculator::calculateInterest(balance, interestRate);
         deposit(interest);
         addTransaction("Interest Applied: $" + formatAmount(interest));
+        Metrics::count(Metrics::InterestPostings);
     }
 
     void display() const override {
+        ScopedSpan span("display");
         cout << "Savings Account: " << owner << " | Balance: $" << fixed << setprecision(2) << balance
             << " | Interest Rate: " << interestRate << "%\n";
     }
@@ -130,73 +1045,407 @@ public:
     }
 
     void deposit(double amount) override {
+        ScopedSpan span("deposit");
         balance += amount;
         addTransaction("Deposited: $" + formatAmount(amount));
+        Metrics::count(Metrics::Deposits);
     }
 
     void withdraw(double amount) override {
-        if (!OverdraftProtection::canWithdraw(balance, overdraftLimit, amount))
+        ScopedSpan span("withdraw");
+        if (!OverdraftProtection::canWithdraw(balance, overdraftLimit, amount)) {
+            Metrics::count(Metrics::Declines);
             throw runtime_error("Overdraft limit exceeded");
+        }
         balance -= amount;
         addTransaction("Withdrawn: $" + formatAmount(amount));
+        Metrics::count(Metrics::Withdrawals);
     }
 
     void display() const override {
+        ScopedSpan span("display");
         cout << "Checking Account: " << owner << " | Balance: $" << fixed << setprecision(2) << balance
             << " | Overdraft Limit: $" << overdraftLimit << "\n";
     }
 };
 
 /**
- * Factory class for creating accounts using C++14 features.
- * Demonstrates use of make_unique and simplified control flow.
+ * Terms a policy-based account is opened with; each policy reads what it needs.
  */
-class AccountFactory {
-public:
-    static unique_ptr<BankAccount> createAccount(const string& type, const string& name, double balance, double extra = 0.0) {
-        if (type == "savings") return make_unique<SavingsAccount>(name, balance, extra);
-        if (type == "checking") return make_unique<CheckingAccount>(name, balance, extra);
-        throw invalid_argument("Unknown account type");
-    }
+struct ProductTerms {
+    double interestRate;
+    double overdraftLimit;
 };
 
 /**
- * Struct representing a node in the customer linked list.
+ * Interest mixins for Account. They are CRTP bases, so SimpleInterest can post
+ * through the account it is part of, and an account without interest simply has
+ * no applyInterest() to call.
  */
-struct CustomerNode {
-    unique_ptr<BankAccount> account;
-    CustomerNode* next;
+template <typename Derived>
+class NoInterest {
+protected:
+    explicit NoInterest(const ProductTerms&) {}
 
-    CustomerNode(unique_ptr<BankAccount> acc)
-        : account(move(acc)), next(nullptr) {
-    }
+public:
+    static constexpr bool accruesInterest = false;
 };
 
-/**
- * Manages a singly linked list of bank accounts.
- */
-class CustomerList {
+template <typename Derived>
+class SimpleInterest {
 private:
-    CustomerNode* head;
+    double interestRate;
+
+protected:
+    explicit SimpleInterest(const ProductTerms& terms) : interestRate(terms.interestRate) {}
 
 public:
-    CustomerList() : head(nullptr) {}
+    static constexpr bool accruesInterest = true;
 
-    ~CustomerList() {
-        while (head) {
-            auto* temp = head;
-            head = head->next;
-            delete temp;
-        }
+    void applyInterest() {
+        Derived& account = static_cast<Derived&>(*this);
+        double interest = InterestCalculator::calculateInterest(account.getBalance(), interestRate);
+        account.credit(interest, "Interest Applied");
+        Metrics::count(Metrics::InterestPostings);
     }
 
-    void addCustomer(unique_ptr<BankAccount> account) {
-        auto* newNode = new CustomerNode(move(account));
-        newNode->next = head;
-        head = newNode;
-    }
+    double getInterestRate() const { return interestRate; }
+};
 
-    bool deleteCustomer(const string& name) {
+/**
+ * Withdrawal rule mixins for Account.
+ */
+template <typename Derived>
+class NoOverdraft {
+protected:
+    explicit NoOverdraft(const ProductTerms&) {}
+    bool allows(double balance, double amount) const { return amount <= balance; }
+    static const char* declineReason() { return "Insufficient funds"; }
+};
+
+template <typename Derived>
+class OverdraftLimit {
+private:
+    double overdraftLimit;
+
+protected:
+    explicit OverdraftLimit(const ProductTerms& terms) : overdraftLimit(terms.overdraftLimit) {}
+    bool allows(double balance, double amount) const { return OverdraftProtection::canWithdraw(balance, overdraftLimit, amount); }
+    static const char* declineReason() { return "Overdraft limit exceeded"; }
+
+public:
+    double getOverdraftLimit() const { return overdraftLimit; }
+};
+
+/**
+ * History mixins for Account: the familiar text lines, or nothing at all.
+ */
+template <typename Derived>
+class TextHistory {
+private:
+    list<string> transactionHistory;
+
+protected:
+    TextHistory() = default;
+
+    void record(const char* label, double amount) {
+        ostringstream stream;
+        stream << fixed << setprecision(2) << amount;
+        transactionHistory.push_back(label + (": $" + stream.str()));
+    }
+
+public:
+    void displayTransactionHistory() const {
+        cout << "Transaction History for " << static_cast<const Derived&>(*this).getOwner() << ":\n";
+        for (const auto& transaction : transactionHistory)
+            cout << transaction << endl;
+    }
+};
+
+template <typename Derived>
+class NoHistory {
+protected:
+    void record(const char*, double) {}
+
+public:
+    void displayTransactionHistory() const {
+        cout << "No transaction history is kept for " << static_cast<const Derived&>(*this).getOwner() << ".\n";
+    }
+};
+
+/**
+ * Account assembled from compile-time policies instead of virtual inheritance.
+ * Deposit and withdrawal are written once here; the interest, overdraft and
+ * history behaviour come from the mixins, and every call resolves statically.
+ */
+template <template <typename> class InterestPolicy, template <typename> class OverdraftPolicy,
+    template <typename> class HistoryPolicy>
+class Account : public InterestPolicy<Account<InterestPolicy, OverdraftPolicy, HistoryPolicy>>,
+    public OverdraftPolicy<Account<InterestPolicy, OverdraftPolicy, HistoryPolicy>>,
+    public HistoryPolicy<Account<InterestPolicy, OverdraftPolicy, HistoryPolicy>> {
+private:
+    using Interest = InterestPolicy<Account>;
+    using Overdraft = OverdraftPolicy<Account>;
+    using History = HistoryPolicy<Account>;
+    friend Interest;
+
+    string owner;
+    double balance;
+
+    void credit(double amount, const char* label) {
+        balance += amount;
+        History::record(label, amount);
+    }
+
+public:
+    Account(string name, double initialBalance, const ProductTerms& terms)
+        : Interest(terms), Overdraft(terms), owner(move(name)), balance(initialBalance) {
+    }
+
+    void deposit(double amount) {
+        ScopedSpan span("deposit");
+        credit(amount, "Deposited");
+        Metrics::count(Metrics::Deposits);
+    }
+
+    void withdraw(double amount) {
+        ScopedSpan span("withdraw");
+        if (!Overdraft::allows(balance, amount)) {
+            Metrics::count(Metrics::Declines);
+            throw runtime_error(Overdraft::declineReason());
+        }
+        balance -= amount;
+        History::record("Withdrawn", amount);
+        Metrics::count(Metrics::Withdrawals);
+    }
+
+    void display() const {
+        cout << "Account: " << owner << " | Balance: $" << fixed << setprecision(2) << balance << "\n";
+    }
+
+    double getBalance() const { return balance; }
+    const string& getOwner() const { return owner; }
+};
+
+using PolicySavingsAccount = Account<SimpleInterest, NoOverdraft, TextHistory>;
+using PolicyCheckingAccount = Account<NoInterest, OverdraftLimit, TextHistory>;
+using PolicyInterestCheckingAccount = Account<SimpleInterest, OverdraftLimit, TextHistory>;
+using PolicyLedgerAccount = Account<NoInterest, OverdraftLimit, NoHistory>;
+
+template <typename PolicyAccount>
+bool applyInterestIfAccrues(PolicyAccount& account, true_type) {
+    account.applyInterest();
+    return true;
+}
+
+template <typename PolicyAccount>
+bool applyInterestIfAccrues(PolicyAccount&, false_type) { return false; }
+
+// The compile-time counterpart of the dynamic_cast to InterestBearing, for generic visitors
+template <typename PolicyAccount>
+bool applyInterestIfAccrues(PolicyAccount& account) {
+    return applyInterestIfAccrues(account, integral_constant<bool, PolicyAccount::accruesInterest>());
+}
+
+// The products AccountFactory offers are instantiated once, here
+template class Account<SimpleInterest, NoOverdraft, TextHistory>;
+template class Account<NoInterest, OverdraftLimit, TextHistory>;
+template class Account<SimpleInterest, OverdraftLimit, TextHistory>;
+template class Account<NoInterest, OverdraftLimit, NoHistory>;
+
+/**
+ * Perfect hash over a fixed set of keywords, built at compile time.
+ * The constructor searches for a seed under which every key lands in its own slot
+ * of a power-of-two table, so a lookup is one hash, one table load and one
+ * length-checked memcmp against the only candidate, with no chain of comparisons.
+ * Declare tables constexpr so the seed search runs in the compiler.
+ */
+template <size_t Count, size_t Slots>
+class PerfectHashTable {
+    static_assert((Slots & (Slots - 1)) == 0 && Slots >= Count, "Slots must be a power of two no smaller than Count");
+
+private:
+    const char* keys[Count];
+    size_t lengths[Count];
+    uint8_t values[Count];
+    int16_t slots[Slots];
+    uint32_t seed;
+
+    static constexpr uint32_t hash(const char* text, size_t length, uint32_t seed) {
+        uint32_t h = 2166136261u ^ seed;
+        for (size_t i = 0; i < length; ++i) {
+            h ^= static_cast<uint8_t>(text[i]);
+            h *= 16777619u;
+        }
+        h ^= h >> 13;
+        h *= 0x5bd1e995u;
+        return h ^ (h >> 15);
+    }
+
+public:
+    constexpr PerfectHashTable(const char* const (&names)[Count], const uint8_t (&codes)[Count])
+        : keys(), lengths(), values(), slots(), seed(0) {
+        for (size_t k = 0; k < Count; ++k) {
+            keys[k] = names[k];
+            values[k] = codes[k];
+            while (names[k][lengths[k]] != '\0') ++lengths[k];
+        }
+        for (uint32_t candidate = 1; candidate < (1u << 20) && seed == 0; ++candidate) {
+            for (size_t i = 0; i < Slots; ++i) slots[i] = -1;
+            bool collision = false;
+            for (size_t k = 0; k < Count && !collision; ++k) {
+                size_t slot = hash(keys[k], lengths[k], candidate) & (Slots - 1);
+                collision = slots[slot] >= 0;
+                slots[slot] = static_cast<int16_t>(k);
+            }
+            if (!collision) seed = candidate;
+        }
+    }
+
+    constexpr bool valid() const { return seed != 0; }
+
+    // The code of the matching keyword, or fallback when there is none
+    uint8_t find(const char* text, size_t length, uint8_t fallback) const {
+        int16_t k = slots[hash(text, length, seed) & (Slots - 1)];
+        return k >= 0 && lengths[k] == length && memcmp(keys[k], text, length) == 0 ? values[k] : fallback;
+    }
+
+    uint8_t find(const string& text, uint8_t fallback) const { return find(text.data(), text.size(), fallback); }
+};
+
+/**
+ * Product names AccountFactory understands.
+ */
+enum class Product : uint8_t { Savings, Checking, InterestChecking, Ledger, Unknown };
+
+constexpr const char* productNames[] = { "savings", "checking", "interest-checking", "ledger" };
+constexpr uint8_t productCodes[] = { 0, 1, 2, 3 };
+constexpr PerfectHashTable<4, 8> productTable(productNames, productCodes);
+static_assert(productTable.valid(), "No perfect hash seed for product names");
+
+inline Product productOf(const string& type) {
+    return static_cast<Product>(productTable.find(type, static_cast<uint8_t>(Product::Unknown)));
+}
+
+/**
+ * Factory class for creating accounts using C++14 features.
+ * Demonstrates use of make_unique and simplified control flow.
+ */
+class AccountFactory {
+public:
+    static unique_ptr<BankAccount> createAccount(const string& type, const string& name, double balance, double extra = 0.0) {
+        switch (productOf(type)) {
+        case Product::Savings: return make_unique<SavingsAccount>(name, balance, extra);
+        case Product::Checking: return make_unique<CheckingAccount>(name, balance, extra);
+        default: throw invalid_argument("Unknown account type");
+        }
+    }
+};
+
+/**
+ * Owning storage for policy-based accounts. Each product keeps its accounts in a
+ * vector of its own specialization, so accounts live as long as the store and a
+ * pass over one product makes no virtual call. A Handle names the product and the
+ * slot and stays valid as the store grows. visit() switches on the product once and
+ * hands the stored account to a visitor, typically a generic lambda compiled once
+ * per product type; forEach() walks every product in turn.
+ * "interest-checking" and "ledger" (no history) exist only as policy accounts.
+ */
+class PolicyAccountStore {
+public:
+    struct Handle {
+        Product product;
+        uint32_t index;
+    };
+
+    Handle open(const string& type, const string& name, double balance, const ProductTerms& terms) {
+        switch (productOf(type)) {
+        case Product::Savings: return append(Product::Savings, savings, name, balance, terms);
+        case Product::Checking: return append(Product::Checking, checking, name, balance, terms);
+        case Product::InterestChecking: return append(Product::InterestChecking, interestChecking, name, balance, terms);
+        case Product::Ledger: return append(Product::Ledger, ledger, name, balance, terms);
+        default: throw invalid_argument("Unknown account type");
+        }
+    }
+
+    template <typename Visitor>
+    auto visit(Handle handle, Visitor visitor) {
+        switch (handle.product) {
+        case Product::Savings: return visitor(at(savings, handle.index));
+        case Product::Checking: return visitor(at(checking, handle.index));
+        case Product::InterestChecking: return visitor(at(interestChecking, handle.index));
+        case Product::Ledger: return visitor(at(ledger, handle.index));
+        default: throw invalid_argument("Unknown account type");
+        }
+    }
+
+    template <typename Visitor>
+    void forEach(Visitor visitor) {
+        for (auto& account : savings) visitor(account);
+        for (auto& account : checking) visitor(account);
+        for (auto& account : interestChecking) visitor(account);
+        for (auto& account : ledger) visitor(account);
+    }
+
+    size_t size() const { return savings.size() + checking.size() + interestChecking.size() + ledger.size(); }
+
+private:
+    vector<PolicySavingsAccount> savings;
+    vector<PolicyCheckingAccount> checking;
+    vector<PolicyInterestCheckingAccount> interestChecking;
+    vector<PolicyLedgerAccount> ledger;
+
+    template <typename PolicyAccount>
+    static Handle append(Product product, vector<PolicyAccount>& accounts, const string& name, double balance, const ProductTerms& terms) {
+        accounts.emplace_back(name, balance, terms);
+        return { product, static_cast<uint32_t>(accounts.size() - 1) };
+    }
+
+    template <typename PolicyAccount>
+    static PolicyAccount& at(vector<PolicyAccount>& accounts, uint32_t index) {
+        if (index >= accounts.size())
+            throw invalid_argument("Invalid account");
+        return accounts[index];
+    }
+};
+
+/**
+ * Struct representing a node in the customer linked list.
+ */
+struct CustomerNode {
+    unique_ptr<BankAccount> account;
+    CustomerNode* next;
+
+    CustomerNode(unique_ptr<BankAccount> acc)
+        : account(move(acc)), next(nullptr) {
+    }
+};
+
+/**
+ * Manages a singly linked list of bank accounts.
+ */
+class CustomerList {
+private:
+    CustomerNode* head;
+
+public:
+    CustomerList() : head(nullptr) {}
+
+    ~CustomerList() {
+        while (head) {
+            auto* temp = head;
+            head = head->next;
+            delete temp;
+        }
+    }
+
+    void addCustomer(unique_ptr<BankAccount> account) {
+        auto* newNode = new CustomerNode(move(account));
+        newNode->next = head;
+        head = newNode;
+    }
+
+    bool deleteCustomer(const string& name) {
         auto* curr = head;
         CustomerNode* prev = nullptr;
 
@@ -214,10 +1463,14 @@ public:
     }
 
     BankAccount* getCustomerByName(const string& name) {
+        ScopedSpan span("getCustomerByName");
         for (auto* curr = head; curr != nullptr; curr = curr->next) {
-            if (curr->account->getOwner() == name)
+            if (curr->account->getOwner() == name) {
+                Metrics::count(Metrics::LookupHits);
                 return curr->account.get();
+            }
         }
+        Metrics::count(Metrics::LookupMisses);
         return nullptr;
     }
 
@@ -226,92 +1479,5886 @@ public:
             curr->account->display();
         }
     }
+
+    // Accounts whose last recorded activity is before the cutoff, read from the accounts themselves
+    vector<BankAccount*> findDormant(time_t cutoff) const {
+        vector<BankAccount*> dormant;
+        for (auto* curr = head; curr != nullptr; curr = curr->next) {
+            if (curr->account->getLastActivity() < cutoff)
+                dormant.push_back(curr->account.get());
+        }
+        return dormant;
+    }
 };
 
 /**
- * Interface for interacting with customer accounts using advanced polymorphism.
+ * Splits [0, count) into one contiguous range per worker thread.
+ * Small ranges stay on the calling thread so tiny books do not pay thread start-up.
  */
-void performBankingOperations(CustomerList& customers) {
-    string name;
-    char choice;
-    double amount;
+inline size_t workerCount(size_t count, size_t minPerWorker = 1 << 16) {
+    size_t hardware = max<size_t>(1, thread::hardware_concurrency());
+    return max<size_t>(1, min(hardware, count / minPerWorker));
+}
 
-    while (true) {
-        cout << "\nEnter account owner name (or 'exit' to quit): ";
-        cin >> name;
-        if (name == "exit") break;
+template <typename Body>
+void parallelFor(size_t count, size_t workers, Body body) {
+    if (workers <= 1) {
+        body(size_t(0), size_t(0), count);
+        return;
+    }
+    vector<thread> threads;
+    size_t step = (count + workers - 1) / workers;
+    for (size_t w = 0; w < workers; ++w) {
+        size_t begin = min(count, w * step);
+        size_t end = min(count, begin + step);
+        threads.emplace_back([=, &body]() {
+            SamplingProfiler::ThreadClass name("worker");
+            body(w, begin, end);
+        });
+    }
+    for (auto& t : threads) t.join();
+}
 
-        auto* account = customers.getCustomerByName(name);
-        if (!account) {
-            cout << "Account not found.\n";
-            continue;
-        }
+enum class AccountKind : uint8_t { Savings, Checking };
+enum class AccountStatus : uint8_t { Active, Dormant, Closed };
+enum class PostingType : uint8_t { Deposit, Withdrawal, Interest, Fee, TransferOut, TransferIn, Reversal };
+// Where a posting came from: teller cash, an electronic channel (ACH, payroll, gateway) or the book itself
+enum class PostingChannel : uint8_t { Cash, Electronic, Internal };
 
-        cout << "\nChoose operation: \nD - Deposit\nW - Withdraw\nS - Show Account\nH - Show Transaction History\nI - Apply Interest\nE - Exit\nChoice: ";
-        cin >> choice;
+/**
+ * Append-only columnar transaction history shared by every account in a book.
+ * Rows are turned into the familiar "Deposited: $..." text only when displayed.
+ * Every row gets a transaction id from one process-wide monotonic sequence, so ids
+ * stay unique across books and increase with the row number within a log.
+ * Reversal rows store their signed effect on the balance as the amount.
+ */
+class TransactionLog {
+public:
+    static constexpr uint32_t noCounterparty = 0xFFFFFFFFu;
 
-        switch (choice) {
-        case 'D': case 'd':
-            cout << "Enter deposit amount: ";
-            cin >> amount;
-            account->deposit(amount);
-            cout << "Deposit successful.\n";
-            break;
+private:
+    vector<uint32_t> accounts;
+    vector<PostingType> types;
+    vector<double> amounts;
+    vector<int64_t> times;
+    vector<uint32_t> counterparties;
+    vector<uint64_t> ids;
+    static atomic<uint64_t> nextId;
 
-        case 'W': case 'w':
-            cout << "Enter withdrawal amount: ";
-            cin >> amount;
-            try {
-                account->withdraw(amount);
-                cout << "Withdrawal successful.\n";
-            }
-            catch (const exception& e) {
-                cout << "Error: " << e.what() << endl;
-            }
-            break;
+public:
+    // Returns the new row's transaction id
+    uint64_t append(uint32_t account, PostingType type, double amount, int64_t time,
+        uint32_t counterparty = noCounterparty) {
+        uint64_t id = nextId.fetch_add(1, memory_order_relaxed);
+        ids.push_back(id);
+        accounts.push_back(account);
+        types.push_back(type);
+        amounts.push_back(amount);
+        times.push_back(time);
+        counterparties.push_back(counterparty);
+        return id;
+    }
 
-        case 'S': case 's':
-            account->display();
-            break;
+    // Adds rows for a bulk writer, with consecutive ids, and returns the first new row
+    size_t grow(size_t rows) {
+        size_t first = accounts.size();
+        uint64_t firstId = nextId.fetch_add(rows, memory_order_relaxed);
+        ids.resize(first + rows);
+        for (size_t i = 0; i < rows; ++i)
+            ids[first + i] = firstId + i;
+        accounts.resize(first + rows);
+        types.resize(first + rows);
+        amounts.resize(first + rows);
+        times.resize(first + rows);
+        counterparties.resize(first + rows);
+        return first;
+    }
 
-        case 'H': case 'h': {
-            auto displayTransactions = [](const BankAccount& acc) {
-                acc.displayTransactionHistory();
-                };
-            displayTransactions(*account);
-            break;
-        }
+    void set(size_t row, uint32_t account, PostingType type, double amount, int64_t time,
+        uint32_t counterparty = noCounterparty) {
+        accounts[row] = account;
+        types[row] = type;
+        amounts[row] = amount;
+        times[row] = time;
+        counterparties[row] = counterparty;
+    }
 
-        case 'I': case 'i': {
-            if (auto* ib = dynamic_cast<InterestBearing*>(account)) {
-                ib->applyInterest();
-                cout << "Interest applied.\n";
-            }
-            else {
-                cout << "This account does not support interest calculation.\n";
+    size_t size() const { return accounts.size(); }
+    uint32_t accountAt(size_t row) const { return accounts[row]; }
+    PostingType typeAt(size_t row) const { return types[row]; }
+    double amountAt(size_t row) const { return amounts[row]; }
+    int64_t timeAt(size_t row) const { return times[row]; }
+    uint32_t counterpartyAt(size_t row) const { return counterparties[row]; }
+    uint64_t idAt(size_t row) const { return ids[row]; }
+
+    size_t memoryUsage() const {
+        return accounts.capacity() * sizeof(uint32_t) + types.capacity() * sizeof(PostingType)
+            + amounts.capacity() * sizeof(double) + times.capacity() * sizeof(int64_t)
+            + counterparties.capacity() * sizeof(uint32_t) + ids.capacity() * sizeof(uint64_t);
+    }
+
+    string describe(size_t row) const {
+        ScopedSpan span("describe");
+        static const char* const labels[] = { "Deposited", "Withdrawn", "Interest Applied", "Fee Charged",
+            "Transferred Out", "Transferred In", "Reversed" };
+        ostringstream stream;
+        stream << labels[static_cast<size_t>(types[row])] << ": $" << fixed << setprecision(2) << amounts[row];
+        return stream.str();
+    }
+};
+
+constexpr uint32_t TransactionLog::noCounterparty;
+atomic<uint64_t> TransactionLog::nextId(1);
+
+/**
+ * Index from transaction id to history row.
+ * Ids of single postings go into a hash map. Once it holds more than its capacity,
+ * the oldest are folded into a sorted list of ranges in which consecutive ids map to
+ * consecutive rows. Bulk postings, whose ids and rows are both contiguous, go
+ * straight in as a single range. Lookups try the hash, then binary-search the ranges.
+ */
+class TransactionIndex {
+private:
+    struct Range {
+        uint64_t firstId;
+        uint64_t firstRow;
+        uint64_t count;
+    };
+
+    unordered_map<uint64_t, uint64_t> recent;
+    deque<uint64_t> recentOrder;
+    vector<Range> ranges;
+    size_t recentCapacity;
+
+    void appendRange(uint64_t firstId, uint64_t firstRow, uint64_t count) {
+        if (!ranges.empty()) {
+            Range& last = ranges.back();
+            if (firstId == last.firstId + last.count && firstRow == last.firstRow + last.count) {
+                last.count += count;
+                return;
             }
-            break;
         }
+        ranges.push_back({ firstId, firstRow, count });
+    }
 
-        case 'E': case 'e':
+    void retireOldest() {
+        uint64_t id = recentOrder.front();
+        recentOrder.pop_front();
+        auto found = recent.find(id);
+        appendRange(id, found->second, 1);
+        recent.erase(found);
+    }
+
+public:
+    explicit TransactionIndex(size_t capacity = 1 << 16) : recentCapacity(capacity) {}
+
+    void add(uint64_t id, uint64_t row) {
+        recent.emplace(id, row);
+        recentOrder.push_back(id);
+        if (recentOrder.size() > recentCapacity)
+            retireOldest();
+    }
+
+    void addRange(uint64_t firstId, uint64_t firstRow, uint64_t count) {
+        if (count == 0)
             return;
+        // Everything in the hash is older; retire it first to keep ranges sorted
+        while (!recentOrder.empty())
+            retireOldest();
+        appendRange(firstId, firstRow, count);
+    }
 
-        default:
-            cout << "Invalid choice.\n";
+    bool find(uint64_t id, uint64_t& row) const {
+        auto hit = recent.find(id);
+        if (hit != recent.end()) {
+            row = hit->second;
+            return true;
         }
+        auto after = upper_bound(ranges.begin(), ranges.end(), id,
+            [](uint64_t value, const Range& range) { return value < range.firstId; });
+        if (after == ranges.begin())
+            return false;
+        const Range& range = *(after - 1);
+        if (id >= range.firstId + range.count)
+            return false;
+        row = range.firstRow + (id - range.firstId);
+        return true;
     }
-}
 
-/**
+    // Approximate: hash nodes are counted as key, value and one link each
+    size_t memoryUsage() const {
+        return recent.bucket_count() * sizeof(void*) + recent.size() * (2 * sizeof(uint64_t) + sizeof(void*))
+            + recentOrder.size() * sizeof(uint64_t) + ranges.capacity() * sizeof(Range);
+    }
+};
+
+/**
+ * One line of a bulk file such as payroll: a credit when amount is positive,
+ * a debit when negative.
+ */
+struct Posting {
+    uint32_t account;
+    double amount;
+};
+
+struct BulkPostResult {
+    size_t posted = 0;          // postings applied
+    size_t accounts = 0;        // distinct accounts touched
+    vector<Posting> rejected;   // postings for unknown accounts or declined net debits
+};
+
+/**
+ * Product catalog: interest rates and overdraft limits shared by every account
+ * that references a product, instead of copied into each account.
+ * The rows live in a small immutable table. A change copies the table, bumps its
+ * version and publishes it with one atomic pointer store; readers take a snapshot
+ * with one acquire load and keep reading that version. Retired tables stay alive
+ * until the catalog is destroyed, so snapshots never dangle and readers never lock.
+ */
+class ProductCatalog {
+public:
+    using ProductId = uint16_t;
+    static constexpr ProductId noProduct = 0xFFFF;
+
+    struct Product {
+        AccountKind kind;
+        double interestRate;
+        double overdraftLimit;
+    };
+
+    struct Table {
+        uint64_t version;
+        vector<Product> rows;
+        vector<string> names;
+    };
+
+private:
+    mutable mutex writer;
+    vector<unique_ptr<Table>> versions;
+    atomic<const Table*> current;
+
+    template <typename Change>
+    void publish(Change change) {
+        lock_guard<mutex> lock(writer);
+        unique_ptr<Table> next(new Table(*versions.back()));
+        ++next->version;
+        change(*next);
+        current.store(next.get(), memory_order_release);
+        versions.push_back(move(next));
+    }
+
+public:
+    ProductCatalog() {
+        versions.emplace_back(new Table{ 0, {}, {} });
+        current.store(versions.back().get(), memory_order_release);
+    }
+
+    ProductCatalog(const ProductCatalog&) = delete;
+    ProductCatalog& operator=(const ProductCatalog&) = delete;
+
+    const Table* snapshot() const { return current.load(memory_order_acquire); }
+
+    ProductId addProduct(const string& name, AccountKind kind, double interestRate, double overdraftLimit) {
+        ProductId id = 0;
+        publish([&](Table& table) {
+            if (table.rows.size() >= noProduct)
+                throw length_error("Product catalog is full");
+            id = static_cast<ProductId>(table.rows.size());
+            table.rows.push_back({ kind, interestRate, overdraftLimit });
+            table.names.push_back(name);
+        });
+        return id;
+    }
+
+    void setInterestRate(ProductId id, double rate) {
+        publish([&](Table& table) { table.rows.at(id).interestRate = rate; });
+    }
+
+    void setOverdraftLimit(ProductId id, double limit) {
+        publish([&](Table& table) { table.rows.at(id).overdraftLimit = limit; });
+    }
+
+    ProductId findProduct(const string& name) const {
+        const Table* table = snapshot();
+        auto found = find(table->names.begin(), table->names.end(), name);
+        return found == table->names.end() ? noProduct : static_cast<ProductId>(found - table->names.begin());
+    }
+};
+
+constexpr ProductCatalog::ProductId ProductCatalog::noProduct;
+
+/**
+ * Interface for components that follow every posting made to an AccountBook.
+ */
+class BookObserver {
+public:
+    virtual void onPosting(uint32_t account, PostingType type, PostingChannel channel, double amount,
+        double oldBalance, double newBalance, int64_t time) = 0;
+    virtual ~BookObserver() = default;
+};
+
+/**
+ * Columnar account book for whole-book scans and bulk actions.
+ * Each account is a row index and every attribute lives in its own array,
+ * so a scan over one attribute streams through contiguous memory.
+ * Applies the same withdrawal rules as SavingsAccount and CheckingAccount.
+ */
+class AccountBook {
+public:
+    using AccountId = uint32_t;
+
+    // Average Gregorian month, used to turn "N months" into a cutoff
+    static constexpr int64_t secondsPerMonth = 2629746;
+
+    static int64_t dormancyCutoff(int64_t now, int months) {
+        return now - months * secondsPerMonth;
+    }
+
+private:
+    vector<string> owners;
+    vector<AccountKind> kinds;
+    vector<double> balances;
+    vector<double> interestRates;
+    vector<double> overdraftLimits;
+    vector<int64_t> lastActivity;
+    vector<AccountStatus> statuses;
+    vector<uint32_t> feeCycles;
+    vector<ProductCatalog::ProductId> products;
+    TransactionLog history;
+    TransactionIndex index;
+    unordered_map<uint64_t, uint64_t> reversals;
+    vector<BookObserver*> observers;
+    const ProductCatalog* catalog = nullptr;
+    // memoryUsage() as of the last growth, for metrics scrapes on other threads
+    atomic<size_t> publishedAccounts{ 0 };
+    atomic<size_t> publishedHistory{ 0 };
+    atomic<size_t> publishedIndex{ 0 };
+
+    void publishMemoryUsage() {
+        if (!Instrumentation::counters)
+            return;
+        MemoryUsage usage = memoryUsage();
+        publishedAccounts.store(usage.accounts, memory_order_relaxed);
+        publishedHistory.store(usage.history, memory_order_relaxed);
+        publishedIndex.store(usage.index, memory_order_relaxed);
+    }
+
+    void notify(AccountId id, PostingType type, double amount, double oldBalance, int64_t now,
+        PostingChannel channel = PostingChannel::Internal) {
+        for (auto* observer : observers)
+            observer->onPosting(id, type, channel, amount, oldBalance, balances[id], now);
+    }
+
+    uint64_t post(AccountId id, PostingType type, double amount, int64_t now,
+        AccountId counterparty = TransactionLog::noCounterparty) {
+        uint64_t transactionId = history.append(id, type, amount, now, counterparty);
+        index.add(transactionId, history.size() - 1);
+        publishMemoryUsage();
+        lastActivity[id] = now;
+        if (statuses[id] == AccountStatus::Dormant)
+            statuses[id] = AccountStatus::Active;
+        return transactionId;
+    }
+
+    size_t growHistory(size_t rows) {
+        size_t firstRow = history.grow(rows);
+        if (rows > 0)
+            index.addRange(history.idAt(firstRow), firstRow, rows);
+        publishMemoryUsage();
+        return firstRow;
+    }
+
+    // Applies a signed correction for the row's transaction and records the reversal row
+    uint64_t compensate(size_t row, double effect, int64_t now) {
+        AccountId id = history.accountAt(row);
+        double oldBalance = balances[id];
+        balances[id] += effect;
+        uint64_t reversalId = history.append(id, PostingType::Reversal, effect, now, history.counterpartyAt(row));
+        index.add(reversalId, history.size() - 1);
+        reversals[history.idAt(row)] = reversalId;
+        publishMemoryUsage();
+        notify(id, PostingType::Reversal, effect, oldBalance, now);
+        Metrics::count(Metrics::Reversals);
+        return reversalId;
+    }
+
+    // Fills out with each account's own term, or its product's term from one catalog snapshot
+    void resolveTerm(vector<double>& out, const vector<double>& own, double ProductCatalog::Product::* term) const {
+        size_t count = own.size();
+        out.resize(count);
+        const ProductCatalog::Table* table = catalog ? catalog->snapshot() : nullptr;
+        parallelFor(count, workerCount(count), [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                out[i] = products[i] == ProductCatalog::noProduct || !table ? own[i] : table->rows[products[i]].*term;
+        });
+    }
+
+public:
+    AccountId openAccount(AccountKind kind, const string& owner, double balance, double extra, int64_t now) {
+        owners.push_back(owner);
+        kinds.push_back(kind);
+        balances.push_back(balance);
+        interestRates.push_back(kind == AccountKind::Savings ? extra : 0.0);
+        overdraftLimits.push_back(kind == AccountKind::Checking ? extra : 0.0);
+        lastActivity.push_back(now);
+        statuses.push_back(AccountStatus::Active);
+        feeCycles.push_back(0);
+        products.push_back(ProductCatalog::noProduct);
+        publishMemoryUsage();
+        return static_cast<AccountId>(balances.size() - 1);
+    }
+
+    // Opens an account whose rate and limit come from the book's product catalog
+    AccountId openAccount(ProductCatalog::ProductId product, const string& owner, double balance, int64_t now) {
+        if (!catalog || product >= catalog->snapshot()->rows.size())
+            throw invalid_argument("Unknown product");
+        AccountId id = openAccount(catalog->snapshot()->rows[product].kind, owner, balance, 0.0, now);
+        products[id] = product;
+        return id;
+    }
+
+    void setCatalog(const ProductCatalog* productCatalog) { catalog = productCatalog; }
+
+    double getInterestRate(AccountId id) const {
+        return products[id] == ProductCatalog::noProduct ? interestRates[id] : catalog->snapshot()->rows[products[id]].interestRate;
+    }
+
+    double getOverdraftLimit(AccountId id) const {
+        return products[id] == ProductCatalog::noProduct ? overdraftLimits[id] : catalog->snapshot()->rows[products[id]].overdraftLimit;
+    }
+
+    void addObserver(BookObserver* observer) { observers.push_back(observer); }
+
+    void removeObserver(BookObserver* observer) {
+        observers.erase(remove(observers.begin(), observers.end(), observer), observers.end());
+    }
+
+    void checkAccount(AccountId id) const {
+        if (id >= balances.size())
+            throw invalid_argument("Unknown account");
+    }
+
+    // Deposits and withdrawals default to teller cash; electronic channels say so
+    uint64_t deposit(AccountId id, double amount, int64_t now, PostingChannel channel = PostingChannel::Cash) {
+        ScopedSpan span("AccountBook::deposit");
+        checkAccount(id);
+        balances[id] += amount;
+        uint64_t transactionId = post(id, PostingType::Deposit, amount, now);
+        notify(id, PostingType::Deposit, amount, balances[id] - amount, now, channel);
+        Metrics::count(Metrics::Deposits);
+        return transactionId;
+    }
+
+    void checkWithdrawal(AccountId id, double amount) const {
+        if (kinds[id] == AccountKind::Savings && amount > balances[id]) {
+            Metrics::count(Metrics::Declines);
+            throw runtime_error("Insufficient funds");
+        }
+        if (!OverdraftProtection::canWithdraw(balances[id], getOverdraftLimit(id), amount)) {
+            Metrics::count(Metrics::Declines);
+            throw runtime_error("Overdraft limit exceeded");
+        }
+    }
+
+    uint64_t withdraw(AccountId id, double amount, int64_t now, PostingChannel channel = PostingChannel::Cash) {
+        ScopedSpan span("AccountBook::withdraw");
+        checkAccount(id);
+        checkWithdrawal(id, amount);
+        balances[id] -= amount;
+        uint64_t transactionId = post(id, PostingType::Withdrawal, amount, now);
+        notify(id, PostingType::Withdrawal, amount, balances[id] + amount, now, channel);
+        Metrics::count(Metrics::Withdrawals);
+        return transactionId;
+    }
+
+    // Moves funds between accounts; each leg records the other account as counterparty.
+    // Returns the id of the outgoing leg; the incoming leg is the next history row.
+    uint64_t transfer(AccountId from, AccountId to, double amount, int64_t now) {
+        checkAccount(from);
+        checkAccount(to);
+        checkWithdrawal(from, amount);
+        balances[from] -= amount;
+        balances[to] += amount;
+        uint64_t transactionId = post(from, PostingType::TransferOut, amount, now, to);
+        post(to, PostingType::TransferIn, amount, now, from);
+        notify(from, PostingType::TransferOut, amount, balances[from] + amount, now);
+        notify(to, PostingType::TransferIn, amount, balances[to] - amount, now);
+        Metrics::count(Metrics::Transfers);
+        return transactionId;
+    }
+
+    uint64_t applyInterest(AccountId id, int64_t now) {
+        ScopedSpan span("AccountBook::applyInterest");
+        checkAccount(id);
+        if (kinds[id] != AccountKind::Savings)
+            throw invalid_argument("Account does not support interest calculation");
+        double interest = InterestCalculator::calculateInterest(balances[id], getInterestRate(id));
+        balances[id] += interest;
+        uint64_t transactionId = post(id, PostingType::Interest, interest, now);
+        notify(id, PostingType::Interest, interest, balances[id] - interest, now);
+        Metrics::count(Metrics::InterestPostings);
+        return transactionId;
+    }
+
+    bool findTransaction(uint64_t transactionId, AccountId& account, size_t& row) const {
+        uint64_t found;
+        if (!index.find(transactionId, found))
+            return false;
+        row = static_cast<size_t>(found);
+        account = history.accountAt(row);
+        return true;
+    }
+
+    // Id of the reversal posted for a transaction, or 0 when it has not been reversed
+    uint64_t reversalOf(uint64_t transactionId) const {
+        auto found = reversals.find(transactionId);
+        return found == reversals.end() ? 0 : found->second;
+    }
+
+    /**
+     * Posts the compensating entry for a transaction and returns the reversal's id.
+     * The original is located through the transaction index, so this is O(1) for
+     * recent ids and a binary search over ranges for older ones. Reversing either leg
+     * of a transfer reverses both. Reversals skip withdrawal limits, since they
+     * correct the book, and do not count as customer activity.
+     */
+    uint64_t reverse(uint64_t transactionId, int64_t now) {
+        AccountId account;
+        size_t row;
+        if (!findTransaction(transactionId, account, row))
+            throw invalid_argument("Unknown transaction");
+        if (reversals.count(transactionId))
+            throw invalid_argument("Transaction already reversed");
+
+        PostingType type = history.typeAt(row);
+        double amount = history.amountAt(row);
+        switch (type) {
+        case PostingType::Deposit:
+        case PostingType::Interest:
+            return compensate(row, -amount, now);
+        case PostingType::Withdrawal:
+        case PostingType::Fee:
+            return compensate(row, amount, now);
+        case PostingType::TransferOut:
+        case PostingType::TransferIn: {
+            size_t outRow = type == PostingType::TransferOut ? row : row - 1;
+            if (outRow + 1 >= history.size() || history.typeAt(outRow) != PostingType::TransferOut
+                || history.typeAt(outRow + 1) != PostingType::TransferIn
+                || history.accountAt(outRow + 1) != history.counterpartyAt(outRow))
+                throw runtime_error("Transfer legs are not adjacent in history");
+            uint64_t reversalId = compensate(outRow, amount, now);
+            compensate(outRow + 1, -amount, now);
+            return reversalId;
+        }
+        default:
+            throw invalid_argument("Cannot reverse a reversal");
+        }
+    }
+
+    /**
+     * Returns active accounts whose last activity is older than cutoff, in id order.
+     * The first pass is a branch-free count over the timestamp and status columns
+     * that the compiler vectorizes; the second pass only writes the rare hits.
+     */
+    vector<AccountId> findDormant(int64_t cutoff) const {
+        size_t count = lastActivity.size();
+        size_t workers = workerCount(count);
+        const int64_t* last = lastActivity.data();
+        const AccountStatus* status = statuses.data();
+
+        vector<size_t> offsets(workers + 1, 0);
+        parallelFor(count, workers, [&](size_t worker, size_t begin, size_t end) {
+            size_t hits = 0;
+            for (size_t i = begin; i < end; ++i)
+                hits += (last[i] < cutoff) & (status[i] == AccountStatus::Active);
+            offsets[worker + 1] = hits;
+        });
+        for (size_t w = 0; w < workers; ++w)
+            offsets[w + 1] += offsets[w];
+
+        vector<AccountId> dormant(offsets[workers]);
+        parallelFor(count, workers, [&](size_t worker, size_t begin, size_t end) {
+            AccountId* out = dormant.data() + offsets[worker];
+            for (size_t i = begin; i < end; ++i) {
+                if ((last[i] < cutoff) & (status[i] == AccountStatus::Active))
+                    *out++ = static_cast<AccountId>(i);
+            }
+        });
+        return dormant;
+    }
+
+    // Bulk status change for a selection such as the result of findDormant
+    void setStatus(const vector<AccountId>& ids, AccountStatus status) {
+        for (AccountId id : ids)
+            statuses[id] = status;
+    }
+
+    /**
+     * Posts one fee per account from a column of amounts indexed by account id.
+     * Accounts already charged in this cycle are skipped, so rerunning a cycle is a no-op.
+     * Fees are not customer activity and leave the last-activity column untouched.
+     * Returns the number of accounts charged.
+     */
+    size_t postFees(const vector<double>& fees, uint32_t cycle, int64_t now) {
+        size_t count = balances.size();
+        if (fees.size() != count)
+            throw invalid_argument("Fee column must have one entry per account");
+        size_t workers = workerCount(count);
+        const double* fee = fees.data();
+        vector<size_t> offsets(workers + 1, 0);
+
+        parallelFor(count, workers, [&](size_t worker, size_t begin, size_t end) {
+            size_t charged = 0;
+            for (size_t i = begin; i < end; ++i)
+                charged += (fee[i] > 0.0) & (feeCycles[i] < cycle);
+            offsets[worker + 1] = charged;
+        });
+        for (size_t w = 0; w < workers; ++w)
+            offsets[w + 1] += offsets[w];
+
+        size_t firstRow = growHistory(offsets[workers]);
+        parallelFor(count, workers, [&](size_t worker, size_t begin, size_t end) {
+            size_t row = firstRow + offsets[worker];
+            for (size_t i = begin; i < end; ++i) {
+                if (fee[i] > 0.0 && feeCycles[i] < cycle) {
+                    balances[i] -= fee[i];
+                    feeCycles[i] = cycle;
+                    history.set(row++, static_cast<AccountId>(i), PostingType::Fee, fee[i], now);
+                }
+            }
+        });
+        // Observers are not thread-safe, so they replay the new rows afterwards
+        if (!observers.empty()) {
+            for (size_t row = firstRow; row < firstRow + offsets[workers]; ++row) {
+                AccountId id = history.accountAt(row);
+                notify(id, PostingType::Fee, fee[id], balances[id] + fee[id], now);
+            }
+        }
+        Metrics::count(Metrics::FeePostings, offsets[workers]);
+        return offsets[workers];
+    }
+
+    /**
+     * Applies a batch of postings in account order instead of one call per posting.
+     * Postings are LSD radix-sorted by account (11-bit digits, only as many passes as
+     * the largest id needs), which keeps each account's postings in file order.
+     * Each account's run is netted and checked once against the usual withdrawal
+     * rules; a declined net debit rejects that account's whole run. Accepted runs
+     * update balances in one ascending sweep, and their history rows are written
+     * into space reserved up front, both split across threads by account range.
+     * Observers are then told about each accepted posting individually, as electronic
+     * (payroll and ACH) rather than cash.
+     */
+    BulkPostResult postBulk(vector<Posting> postings, int64_t now) {
+        BulkPostResult result;
+        uint32_t highest = 0;
+        for (const auto& posting : postings)
+            highest = max(highest, posting.account);
+
+        vector<Posting> scratch(postings.size());
+        for (int shift = 0; shift < 32 && (highest >> shift) != 0; shift += 11) {
+            size_t positions[2048] = {};
+            for (const auto& posting : postings)
+                ++positions[(posting.account >> shift) & 2047];
+            size_t total = 0;
+            for (size_t& position : positions) {
+                size_t count = position;
+                position = total;
+                total += count;
+            }
+            for (const auto& posting : postings)
+                scratch[positions[(posting.account >> shift) & 2047]++] = posting;
+            postings.swap(scratch);
+        }
+
+        struct Run {
+            size_t begin, end;
+            double net;
+        };
+        vector<Run> runs;
+        vector<size_t> rowOffsets(1, 0);
+        for (size_t i = 0; i < postings.size();) {
+            size_t end = i;
+            double net = 0;
+            while (end < postings.size() && postings[end].account == postings[i].account)
+                net += postings[end++].amount;
+            AccountId id = postings[i].account;
+            bool accepted = id < balances.size() && statuses[id] != AccountStatus::Closed;
+            if (accepted && net < 0) {
+                try { checkWithdrawal(id, -net); }
+                catch (const runtime_error&) { accepted = false; }
+            }
+            if (accepted) {
+                runs.push_back({ i, end, net });
+                rowOffsets.push_back(rowOffsets.back() + (end - i));
+            }
+            else {
+                result.rejected.insert(result.rejected.end(), postings.begin() + i, postings.begin() + end);
+            }
+            i = end;
+        }
+
+        size_t firstRow = growHistory(rowOffsets.back());
+        parallelFor(runs.size(), workerCount(runs.size(), 1 << 14), [&](size_t, size_t begin, size_t end) {
+            for (size_t r = begin; r < end; ++r) {
+                const Run& run = runs[r];
+                AccountId id = postings[run.begin].account;
+                balances[id] += run.net;
+                lastActivity[id] = now;
+                if (statuses[id] == AccountStatus::Dormant)
+                    statuses[id] = AccountStatus::Active;
+                size_t row = firstRow + rowOffsets[r];
+                for (size_t i = run.begin; i < run.end; ++i) {
+                    double amount = postings[i].amount;
+                    history.set(row++, id, amount >= 0 ? PostingType::Deposit : PostingType::Withdrawal,
+                        amount >= 0 ? amount : -amount, now);
+                }
+            }
+        });
+        // Observers see every posting in file order, with the balance stepping through the run
+        if (!observers.empty()) {
+            for (const Run& run : runs) {
+                AccountId id = postings[run.begin].account;
+                double balance = balances[id] - run.net;
+                for (size_t i = run.begin; i < run.end; ++i) {
+                    double amount = postings[i].amount;
+                    PostingType type = amount >= 0 ? PostingType::Deposit : PostingType::Withdrawal;
+                    for (auto* observer : observers)
+                        observer->onPosting(id, type, PostingChannel::Electronic, amount >= 0 ? amount : -amount,
+                            balance, balance + amount, now);
+                    balance += amount;
+                }
+            }
+        }
+
+        result.posted = rowOffsets.back();
+        result.accounts = runs.size();
+        Metrics::count(Metrics::BulkPostings, result.posted);
+        Metrics::observe(Metrics::BulkBatchSize, postings.size());
+        return result;
+    }
+
+    /**
+     * Credits interest to every open savings account with a positive balance in one pass.
+     * Product accounts read their rate from a single catalog snapshot taken up front,
+     * so a concurrent rate change applies to the whole run or not at all.
+     * Like fees, interest is not customer activity. Returns the number of accounts credited.
+     */
+    size_t applyInterestBulk(int64_t now) {
+        const ProductCatalog::Table* table = catalog ? catalog->snapshot() : nullptr;
+        const ProductCatalog::Product* rows = table ? table->rows.data() : nullptr;
+        size_t count = balances.size();
+        size_t workers = workerCount(count);
+        auto eligible = [&](size_t i) {
+            return kinds[i] == AccountKind::Savings && statuses[i] != AccountStatus::Closed && balances[i] > 0.0;
+        };
+
+        vector<size_t> offsets(workers + 1, 0);
+        parallelFor(count, workers, [&](size_t worker, size_t begin, size_t end) {
+            size_t credited = 0;
+            for (size_t i = begin; i < end; ++i)
+                credited += eligible(i);
+            offsets[worker + 1] = credited;
+        });
+        for (size_t w = 0; w < workers; ++w)
+            offsets[w + 1] += offsets[w];
+
+        size_t firstRow = growHistory(offsets[workers]);
+        parallelFor(count, workers, [&](size_t worker, size_t begin, size_t end) {
+            size_t row = firstRow + offsets[worker];
+            for (size_t i = begin; i < end; ++i) {
+                if (!eligible(i))
+                    continue;
+                double rate = products[i] == ProductCatalog::noProduct ? interestRates[i] : rows[products[i]].interestRate;
+                double interest = InterestCalculator::calculateInterest(balances[i], rate);
+                balances[i] += interest;
+                history.set(row++, static_cast<AccountId>(i), PostingType::Interest, interest, now);
+            }
+        });
+        if (!observers.empty()) {
+            for (size_t row = firstRow; row < firstRow + offsets[workers]; ++row) {
+                AccountId id = history.accountAt(row);
+                double interest = history.amountAt(row);
+                notify(id, PostingType::Interest, interest, balances[id] - interest, now);
+            }
+        }
+        Metrics::count(Metrics::InterestPostings, offsets[workers]);
+        return offsets[workers];
+    }
+
+    // Read-only column views for whole-book evaluators
+    const AccountKind* kindColumn() const { return kinds.data(); }
+    const double* balanceColumn() const { return balances.data(); }
+    const double* interestRateColumn() const { return interestRates.data(); }
+    const double* overdraftLimitColumn() const { return overdraftLimits.data(); }
+
+    // Dense columns of effective terms, with product accounts resolved through the catalog
+    void resolveInterestRates(vector<double>& out) const { resolveTerm(out, interestRates, &ProductCatalog::Product::interestRate); }
+    void resolveOverdraftLimits(vector<double>& out) const { resolveTerm(out, overdraftLimits, &ProductCatalog::Product::overdraftLimit); }
+    const int64_t* lastActivityColumn() const { return lastActivity.data(); }
+    const ProductCatalog::ProductId* productColumn() const { return products.data(); }
+    const AccountStatus* statusColumn() const { return statuses.data(); }
+    const uint32_t* feeCycleColumn() const { return feeCycles.data(); }
+
+    size_t size() const { return balances.size(); }
+    const string& getOwner(AccountId id) const { return owners[id]; }
+    AccountKind getKind(AccountId id) const { return kinds[id]; }
+    ProductCatalog::ProductId getProduct(AccountId id) const { return products[id]; }
+    double getBalance(AccountId id) const { return balances[id]; }
+    int64_t getLastActivity(AccountId id) const { return lastActivity[id]; }
+    AccountStatus getStatus(AccountId id) const { return statuses[id]; }
+    const TransactionLog& getHistory() const { return history; }
+
+    struct MemoryUsage {
+        size_t accounts;
+        size_t history;
+        size_t index;
+    };
+
+    // Bytes reserved by each part of the book; owner names count only their inline storage
+    MemoryUsage memoryUsage() const {
+        size_t columns = owners.capacity() * sizeof(string) + kinds.capacity() * sizeof(AccountKind)
+            + (balances.capacity() + interestRates.capacity() + overdraftLimits.capacity()) * sizeof(double)
+            + lastActivity.capacity() * sizeof(int64_t) + statuses.capacity() * sizeof(AccountStatus)
+            + feeCycles.capacity() * sizeof(uint32_t) + products.capacity() * sizeof(ProductCatalog::ProductId);
+        return { columns, history.memoryUsage(), index.memoryUsage() + reversals.size() * 3 * sizeof(uint64_t) };
+    }
+
+    // Safe to call from any thread while the owning thread posts; zero at level 0
+    MemoryUsage publishedMemoryUsage() const {
+        return { publishedAccounts.load(memory_order_relaxed), publishedHistory.load(memory_order_relaxed),
+            publishedIndex.load(memory_order_relaxed) };
+    }
+};
+
+constexpr int64_t AccountBook::secondsPerMonth;
+
+/**
+ * Memory gauges for one book, registered for as long as this object lives.
+ * Scrapes read the figures the book publishes as it grows, so the writer thread
+ * never walks containers the posting thread is changing.
+ */
+class BookMetrics {
+private:
+    MetricsGauge accounts;
+    MetricsGauge history;
+    MetricsGauge index;
+
+public:
+    explicit BookMetrics(const AccountBook& book)
+        : accounts("bank_memory_bytes{subsystem=\"accounts\"}", "Bytes reserved per subsystem.",
+            [&book]() { return static_cast<double>(book.publishedMemoryUsage().accounts); }),
+        history("bank_memory_bytes{subsystem=\"history\"}", "Bytes reserved per subsystem.",
+            [&book]() { return static_cast<double>(book.publishedMemoryUsage().history); }),
+        index("bank_memory_bytes{subsystem=\"transaction_index\"}", "Bytes reserved per subsystem.",
+            [&book]() { return static_cast<double>(book.publishedMemoryUsage().index); }) {
+    }
+};
+
+/**
+ * Conditions a fee rule can charge on.
+ */
+enum class FeeCondition : uint8_t {
+    Maintenance,     // every account of the kind
+    MinimumBalance,  // balance below threshold
+    Overdrawn,       // balance below zero
+    Dormant          // account flagged dormant
+};
+
+struct FeeRule {
+    AccountKind kind;
+    FeeCondition condition;
+    double amount;
+    double threshold;
+};
+
+/**
+ * Rule-driven batch fee engine.
+ * Each rule is evaluated as one branch-free pass over the kind, status and balance
+ * columns, accumulating into a fee column that AccountBook::postFees posts in bulk.
+ */
+class FeeEngine {
+private:
+    vector<FeeRule> rules;
+
+public:
+    void addRule(const FeeRule& rule) { rules.push_back(rule); }
+
+    vector<double> evaluate(const AccountBook& book, uint32_t cycle) const {
+        size_t count = book.size();
+        vector<double> fees(count, 0.0);
+        const AccountKind* kinds = book.kindColumn();
+        const double* balances = book.balanceColumn();
+        const AccountStatus* statuses = book.statusColumn();
+        const uint32_t* cycles = book.feeCycleColumn();
+
+        parallelFor(count, workerCount(count), [&](size_t, size_t begin, size_t end) {
+            double* fee = fees.data();
+            for (const FeeRule& rule : rules) {
+                // One tight loop per condition keeps the switch out of the per-row path
+                switch (rule.condition) {
+                case FeeCondition::Maintenance:
+                    for (size_t i = begin; i < end; ++i)
+                        fee[i] += kinds[i] == rule.kind ? rule.amount : 0.0;
+                    break;
+                case FeeCondition::MinimumBalance:
+                    for (size_t i = begin; i < end; ++i)
+                        fee[i] += (kinds[i] == rule.kind) & (balances[i] < rule.threshold) ? rule.amount : 0.0;
+                    break;
+                case FeeCondition::Overdrawn:
+                    for (size_t i = begin; i < end; ++i)
+                        fee[i] += (kinds[i] == rule.kind) & (balances[i] < 0.0) ? rule.amount : 0.0;
+                    break;
+                case FeeCondition::Dormant:
+                    for (size_t i = begin; i < end; ++i)
+                        fee[i] += (kinds[i] == rule.kind) & (statuses[i] == AccountStatus::Dormant) ? rule.amount : 0.0;
+                    break;
+                }
+            }
+            for (size_t i = begin; i < end; ++i) {
+                if (statuses[i] == AccountStatus::Closed || cycles[i] >= cycle)
+                    fee[i] = 0.0;
+            }
+        });
+        return fees;
+    }
+
+    // Evaluates and posts one billing cycle; returns the number of accounts charged
+    size_t runCycle(AccountBook& book, uint32_t cycle, int64_t now) const {
+        return book.postFees(evaluate(book, cycle), cycle, now);
+    }
+};
+
+/**
+ * Compiled conjunctive filter over AccountBook columns, for example
+ * "kind == checking and balance < -200 and overdraft > 400".
+ * Columns: kind, status, product, balance, rate, overdraft, lastactivity.
+ * rate and overdraft are effective terms: product accounts read theirs from the catalog,
+ * resolved into a dense column once per run().
+ * Operators: < <= > >= == !=. Literals: numbers, savings, checking, active, dormant, closed.
+ * kind, status, product and lastactivity take whole numbers within the column's range.
+ *
+ * The constructor parses the expression once and binds every predicate to a comparison
+ * kernel specialised for its column type and operator. run() walks the book in
+ * batches: the first predicate compares its column densely into a mask the compiler
+ * vectorizes and compacts it into a selection vector, and each later predicate only
+ * narrows that selection, so there is no per-row dispatch.
+ */
+class AccountFilter {
+public:
+    using AccountId = AccountBook::AccountId;
+    static constexpr size_t batchSize = 1024;
+
+private:
+    // Returns the column to scan; derived columns are materialized into scratch
+    using ColumnFn = const void* (*)(const AccountBook&, vector<double>& scratch);
+    using DenseFn = size_t(*)(const void*, double, size_t, size_t, AccountId*);
+    using RefineFn = size_t(*)(const void*, double, AccountId*, size_t);
+
+    struct Predicate {
+        ColumnFn column;
+        DenseFn dense;
+        RefineFn refine;
+        double literal;
+    };
+
+    template <typename T, typename Compare>
+    struct Kernel {
+        static size_t dense(const void* column, double literal, size_t begin, size_t end, AccountId* out) {
+            const T* values = static_cast<const T*>(column) + begin;
+            const T bound = static_cast<T>(literal);
+            const size_t rows = end - begin;
+            uint8_t mask[batchSize];
+            for (size_t i = 0; i < rows; ++i)
+                mask[i] = Compare()(values[i], bound);
+            size_t count = 0;
+            for (size_t i = 0; i < rows; ++i) {
+                out[count] = static_cast<AccountId>(begin + i);
+                count += mask[i];
+            }
+            return count;
+        }
+
+        static size_t refine(const void* column, double literal, AccountId* selection, size_t count) {
+            const T* values = static_cast<const T*>(column);
+            const T bound = static_cast<T>(literal);
+            size_t kept = 0;
+            for (size_t i = 0; i < count; ++i) {
+                AccountId row = selection[i];
+                selection[kept] = row;
+                kept += Compare()(values[row], bound);
+            }
+            return kept;
+        }
+    };
+
+    vector<Predicate> predicates;
+
+    // Kernels compare against static_cast<T>(literal), so integer columns need a whole number T can hold
+    template <typename T>
+    static void bind(Predicate& predicate, const string& op, const string& token) {
+        if (is_integral<T>::value && (predicate.literal != floor(predicate.literal)
+            || predicate.literal < static_cast<double>(numeric_limits<T>::min())
+            || predicate.literal >= static_cast<double>(numeric_limits<T>::max()) + 1.0))
+            throw invalid_argument("Filter literal does not fit its column: " + token);
+        if (op == "<") { predicate.dense = Kernel<T, less<T>>::dense; predicate.refine = Kernel<T, less<T>>::refine; }
+        else if (op == "<=") { predicate.dense = Kernel<T, less_equal<T>>::dense; predicate.refine = Kernel<T, less_equal<T>>::refine; }
+        else if (op == ">") { predicate.dense = Kernel<T, greater<T>>::dense; predicate.refine = Kernel<T, greater<T>>::refine; }
+        else if (op == ">=") { predicate.dense = Kernel<T, greater_equal<T>>::dense; predicate.refine = Kernel<T, greater_equal<T>>::refine; }
+        else if (op == "==") { predicate.dense = Kernel<T, equal_to<T>>::dense; predicate.refine = Kernel<T, equal_to<T>>::refine; }
+        else if (op == "!=") { predicate.dense = Kernel<T, not_equal_to<T>>::dense; predicate.refine = Kernel<T, not_equal_to<T>>::refine; }
+        else throw invalid_argument("Unknown filter operator: " + op);
+    }
+
+    static double parseLiteral(const string& token) {
+        if (token == "savings" || token == "active") return 0;
+        if (token == "checking" || token == "dormant") return 1;
+        if (token == "closed") return 2;
+        size_t used = 0;
+        double value = 0;
+        try { value = stod(token, &used); }
+        catch (const exception&) { used = 0; }
+        if (used != token.size() || !isfinite(value))
+            throw invalid_argument("Invalid filter literal: " + token);
+        return value;
+    }
+
+    // Splits on whitespace and around operator characters
+    static vector<string> tokenize(const string& expression) {
+        vector<string> tokens;
+        size_t i = 0;
+        while (i < expression.size()) {
+            char c = expression[i];
+            if (isspace(static_cast<unsigned char>(c))) { ++i; continue; }
+            size_t start = i;
+            if (c == '<' || c == '>' || c == '=' || c == '!') {
+                ++i;
+                if (i < expression.size() && expression[i] == '=') ++i;
+            }
+            else {
+                while (i < expression.size() && !isspace(static_cast<unsigned char>(expression[i]))
+                    && expression[i] != '<' && expression[i] != '>' && expression[i] != '=' && expression[i] != '!')
+                    ++i;
+            }
+            string token = expression.substr(start, i - start);
+            transform(token.begin(), token.end(), token.begin(), [](char ch) { return static_cast<char>(tolower(static_cast<unsigned char>(ch))); });
+            tokens.push_back(token);
+        }
+        return tokens;
+    }
+
+public:
+    explicit AccountFilter(const string& expression) {
+        vector<string> tokens = tokenize(expression);
+        if (tokens.empty())
+            throw invalid_argument("Filter expects \"column op value [and ...]\"");
+        for (size_t i = 0; i < tokens.size(); i += 4) {
+            // Each predicate is three tokens, and an "and" must be followed by another predicate
+            if (i + 3 > tokens.size() || (i + 3 < tokens.size() && (tokens[i + 3] != "and" || i + 4 == tokens.size())))
+                throw invalid_argument("Filter expects \"column op value [and ...]\"");
+            const string& column = tokens[i];
+            Predicate predicate{};
+            predicate.literal = parseLiteral(tokens[i + 2]);
+            if (column == "kind") {
+                predicate.column = [](const AccountBook& b, vector<double>&) { return static_cast<const void*>(b.kindColumn()); };
+                bind<uint8_t>(predicate, tokens[i + 1], tokens[i + 2]);
+            }
+            else if (column == "status") {
+                predicate.column = [](const AccountBook& b, vector<double>&) { return static_cast<const void*>(b.statusColumn()); };
+                bind<uint8_t>(predicate, tokens[i + 1], tokens[i + 2]);
+            }
+            else if (column == "product") {
+                predicate.column = [](const AccountBook& b, vector<double>&) { return static_cast<const void*>(b.productColumn()); };
+                bind<uint16_t>(predicate, tokens[i + 1], tokens[i + 2]);
+            }
+            else if (column == "balance") {
+                predicate.column = [](const AccountBook& b, vector<double>&) { return static_cast<const void*>(b.balanceColumn()); };
+                bind<double>(predicate, tokens[i + 1], tokens[i + 2]);
+            }
+            else if (column == "rate") {
+                predicate.column = [](const AccountBook& b, vector<double>& scratch) {
+                    b.resolveInterestRates(scratch);
+                    return static_cast<const void*>(scratch.data());
+                };
+                bind<double>(predicate, tokens[i + 1], tokens[i + 2]);
+            }
+            else if (column == "overdraft") {
+                predicate.column = [](const AccountBook& b, vector<double>& scratch) {
+                    b.resolveOverdraftLimits(scratch);
+                    return static_cast<const void*>(scratch.data());
+                };
+                bind<double>(predicate, tokens[i + 1], tokens[i + 2]);
+            }
+            else if (column == "lastactivity") {
+                predicate.column = [](const AccountBook& b, vector<double>&) { return static_cast<const void*>(b.lastActivityColumn()); };
+                bind<int64_t>(predicate, tokens[i + 1], tokens[i + 2]);
+            }
+            else {
+                throw invalid_argument("Unknown filter column: " + column);
+            }
+            predicates.push_back(predicate);
+        }
+    }
+
+    // Matching account ids in ascending order
+    vector<AccountId> run(const AccountBook& book) const {
+        size_t count = book.size();
+        size_t workers = workerCount(count);
+        vector<const void*> columns;
+        vector<vector<double>> scratch(predicates.size());
+        for (size_t p = 0; p < predicates.size(); ++p)
+            columns.push_back(predicates[p].column(book, scratch[p]));
+
+        vector<vector<AccountId>> parts(workers);
+        parallelFor(count, workers, [&](size_t worker, size_t begin, size_t end) {
+            AccountId selection[batchSize];
+            for (size_t batch = begin; batch < end; batch += batchSize) {
+                size_t stop = min(end, batch + batchSize);
+                size_t selected = predicates[0].dense(columns[0], predicates[0].literal, batch, stop, selection);
+                for (size_t p = 1; p < predicates.size() && selected > 0; ++p)
+                    selected = predicates[p].refine(columns[p], predicates[p].literal, selection, selected);
+                parts[worker].insert(parts[worker].end(), selection, selection + selected);
+            }
+        });
+
+        vector<AccountId> matches;
+        for (auto& part : parts)
+            matches.insert(matches.end(), part.begin(), part.end());
+        return matches;
+    }
+};
+
+constexpr size_t AccountFilter::batchSize;
+
+/**
+ * Customer layer over an AccountBook: customers own accounts and belong to households.
+ * Membership is kept in flat id arrays threaded as singly linked lists
+ * (first account per customer, next account per account, and likewise for
+ * household members). Combined balance and exposure per customer and household
+ * are updated from each posting, so relationship views never scan the book.
+ * Exposure is the total amount by which linked accounts are overdrawn.
+ */
+class CustomerRegistry : public BookObserver {
+public:
+    using AccountId = AccountBook::AccountId;
+    using CustomerId = uint32_t;
+    using HouseholdId = uint32_t;
+    static constexpr uint32_t none = 0xFFFFFFFFu;
+
+private:
+    AccountBook& book;
+
+    vector<string> customerNames;
+    vector<HouseholdId> customerHousehold;
+    vector<AccountId> firstAccount;
+    vector<CustomerId> nextMember;
+    vector<double> customerBalance;
+    vector<double> customerExposure;
+
+    vector<CustomerId> accountCustomer;
+    vector<AccountId> nextAccount;
+
+    vector<CustomerId> firstMember;
+    vector<double> householdBalance;
+    vector<double> householdExposure;
+
+    static double exposureOf(double balance) { return balance < 0.0 ? -balance : 0.0; }
+
+    void checkCustomer(CustomerId customer) const {
+        if (customer >= customerNames.size())
+            throw invalid_argument("Unknown customer");
+    }
+
+    void checkHousehold(HouseholdId household) const {
+        if (household != none && household >= firstMember.size())
+            throw invalid_argument("Unknown household");
+    }
+
+    void adjust(CustomerId customer, double balanceDelta, double exposureDelta) {
+        customerBalance[customer] += balanceDelta;
+        customerExposure[customer] += exposureDelta;
+        HouseholdId household = customerHousehold[customer];
+        if (household != none) {
+            householdBalance[household] += balanceDelta;
+            householdExposure[household] += exposureDelta;
+        }
+    }
+
+public:
+    explicit CustomerRegistry(AccountBook& accounts) : book(accounts) { book.addObserver(this); }
+    ~CustomerRegistry() override { book.removeObserver(this); }
+    CustomerRegistry(const CustomerRegistry&) = delete;
+    CustomerRegistry& operator=(const CustomerRegistry&) = delete;
+
+    HouseholdId addHousehold() {
+        firstMember.push_back(none);
+        householdBalance.push_back(0.0);
+        householdExposure.push_back(0.0);
+        return static_cast<HouseholdId>(firstMember.size() - 1);
+    }
+
+    CustomerId addCustomer(const string& name, HouseholdId household = none) {
+        checkHousehold(household);
+        customerNames.push_back(name);
+        customerHousehold.push_back(none);
+        firstAccount.push_back(none);
+        nextMember.push_back(none);
+        customerBalance.push_back(0.0);
+        customerExposure.push_back(0.0);
+        CustomerId id = static_cast<CustomerId>(customerNames.size() - 1);
+        if (household != none)
+            joinHousehold(id, household);
+        return id;
+    }
+
+    void linkAccount(CustomerId customer, AccountId account) {
+        checkCustomer(customer);
+        book.checkAccount(account);
+        if (account >= accountCustomer.size()) {
+            accountCustomer.resize(account + 1, none);
+            nextAccount.resize(account + 1, none);
+        }
+        if (accountCustomer[account] != none)
+            throw invalid_argument("Account already belongs to a customer");
+        accountCustomer[account] = customer;
+        nextAccount[account] = firstAccount[customer];
+        firstAccount[customer] = account;
+        double balance = book.getBalance(account);
+        adjust(customer, balance, exposureOf(balance));
+    }
+
+    // Moves a customer, with their running totals, into another household (or none)
+    void joinHousehold(CustomerId customer, HouseholdId household) {
+        checkCustomer(customer);
+        checkHousehold(household);
+        HouseholdId current = customerHousehold[customer];
+        if (current == household)
+            return;
+        if (current != none) {
+            householdBalance[current] -= customerBalance[customer];
+            householdExposure[current] -= customerExposure[customer];
+            CustomerId* link = &firstMember[current];
+            while (*link != customer)
+                link = &nextMember[*link];
+            *link = nextMember[customer];
+            nextMember[customer] = none;
+        }
+        customerHousehold[customer] = household;
+        if (household != none) {
+            householdBalance[household] += customerBalance[customer];
+            householdExposure[household] += customerExposure[customer];
+            nextMember[customer] = firstMember[household];
+            firstMember[household] = customer;
+        }
+    }
+
+    void onPosting(uint32_t account, PostingType, PostingChannel, double, double oldBalance, double newBalance, int64_t) override {
+        if (account >= accountCustomer.size() || accountCustomer[account] == none)
+            return;
+        adjust(accountCustomer[account], newBalance - oldBalance, exposureOf(newBalance) - exposureOf(oldBalance));
+    }
+
+    vector<AccountId> accountsOf(CustomerId customer) const {
+        vector<AccountId> accounts;
+        for (AccountId a = firstAccount[customer]; a != none; a = nextAccount[a])
+            accounts.push_back(a);
+        return accounts;
+    }
+
+    vector<CustomerId> membersOf(HouseholdId household) const {
+        vector<CustomerId> members;
+        for (CustomerId c = firstMember[household]; c != none; c = nextMember[c])
+            members.push_back(c);
+        return members;
+    }
+
+    CustomerId customerOf(AccountId account) const {
+        return account < accountCustomer.size() ? accountCustomer[account] : none;
+    }
+
+    size_t customerCount() const { return customerNames.size(); }
+    size_t householdCount() const { return firstMember.size(); }
+    const string& getName(CustomerId customer) const { return customerNames[customer]; }
+    HouseholdId getHousehold(CustomerId customer) const { return customerHousehold[customer]; }
+    double getCustomerBalance(CustomerId customer) const { return customerBalance[customer]; }
+    double getCustomerExposure(CustomerId customer) const { return customerExposure[customer]; }
+    double getHouseholdBalance(HouseholdId household) const { return householdBalance[household]; }
+    double getHouseholdExposure(HouseholdId household) const { return householdExposure[household]; }
+};
+
+constexpr uint32_t CustomerRegistry::none;
+
+/**
+ * Per-party running cash totals for one business day, in an open-addressing
+ * hash table (linear probing, power-of-two capacity, grown at 70% load).
+ * Keys are tagged so customers and accounts with no customer on file never share
+ * a slot, even where their ids coincide.
+ */
+class DailyCashTable {
+public:
+    static constexpr uint64_t emptyKey = ~0ull;
+
+    static uint64_t customerKey(uint32_t customer) { return customer; }
+    static uint64_t accountKey(uint32_t account) { return (1ull << 32) | account; }
+    static bool isAccountKey(uint64_t key) { return (key >> 32) == 1; }
+
+    struct Slot {
+        uint64_t key = emptyKey;
+        uint32_t countIn = 0;
+        uint32_t countOut = 0;
+        int64_t centsIn = 0;
+        int64_t centsOut = 0;
+        int64_t largestIn = 0;
+        int64_t largestOut = 0;
+    };
+
+private:
+    vector<Slot> slots;
+    size_t used = 0;
+
+    static size_t hash(uint64_t key) { return static_cast<size_t>(key * 0x9E3779B97F4A7C15ull >> 20); }
+
+    void rehash(size_t capacity) {
+        vector<Slot> old(capacity);
+        old.swap(slots);
+        used = 0;
+        for (const Slot& slot : old) {
+            if (slot.key != emptyKey)
+                find(slot.key) = slot;
+        }
+    }
+
+public:
+    explicit DailyCashTable(size_t capacity = 1024) : slots(capacity) {}
+
+    Slot& find(uint64_t key) {
+        if ((used + 1) * 10 > slots.size() * 7)
+            rehash(slots.size() * 2);
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+            if (slots[i].key == key)
+                return slots[i];
+            if (slots[i].key == emptyKey) {
+                slots[i].key = key;
+                ++used;
+                return slots[i];
+            }
+        }
+    }
+
+    const vector<Slot>& contents() const { return slots; }
+    size_t size() const { return used; }
+
+    void clear() {
+        fill(slots.begin(), slots.end(), Slot());
+        used = 0;
+    }
+};
+
+constexpr uint64_t DailyCashTable::emptyKey;
+
+/**
+ * Streaming aggregation for large cash transaction reporting.
+ * Sits on the posting path as a BookObserver. Only deposits and withdrawals on the
+ * cash channel count; bulk, ACH and gateway postings are electronic. Activity is
+ * keyed by customer through a CustomerRegistry when one is given; accounts with no
+ * customer are aggregated on their own, never folded into a customer's total.
+ * Each posting costs one probe into the current day's table. The first posting of
+ * a new business day only swaps that table out; postings dated to the closed day
+ * still land in its table until endOfDay() runs, and anything older is counted as
+ * late instead. endOfDay() is the flush job: it evaluates the closed day and emits
+ * candidates in batches:
+ *  - exceedsThreshold: cash in or cash out over the threshold ($10,000)
+ *  - structured: two or more transactions, each under the threshold, whose total
+ *    reaches the structuring floor (80% of the threshold by default)
+ */
+class CashReportingMonitor : public BookObserver {
+public:
+    struct Candidate {
+        uint32_t customer;      // an account id when unlinkedAccount is set
+        bool unlinkedAccount;
+        int64_t businessDay;
+        double cashIn;
+        double cashOut;
+        uint32_t transactions;
+        bool exceedsThreshold;
+        bool structured;
+    };
+
+    using Sink = function<void(const vector<Candidate>&)>;
+
+private:
+    AccountBook& book;
+    const CustomerRegistry* registry;
+    Sink sink;
+    int64_t thresholdCents;
+    int64_t structuringFloorCents;
+    int64_t dayOffsetSeconds;
+    size_t batchSize;
+
+    int64_t currentDay = -1;
+    int64_t closedDay = -1;
+    DailyCashTable today;
+    DailyCashTable closed;
+    vector<Candidate> pending;
+    size_t late = 0;
+
+    void evaluate(const DailyCashTable& table, int64_t day) {
+        for (const auto& slot : table.contents()) {
+            if (slot.key == DailyCashTable::emptyKey)
+                continue;
+            bool exceeds = slot.centsIn > thresholdCents || slot.centsOut > thresholdCents;
+            bool structuredIn = slot.countIn >= 2 && slot.largestIn <= thresholdCents && slot.centsIn >= structuringFloorCents;
+            bool structuredOut = slot.countOut >= 2 && slot.largestOut <= thresholdCents && slot.centsOut >= structuringFloorCents;
+            if (!exceeds && !structuredIn && !structuredOut)
+                continue;
+            pending.push_back({ static_cast<uint32_t>(slot.key), DailyCashTable::isAccountKey(slot.key), day,
+                slot.centsIn / 100.0, slot.centsOut / 100.0,
+                slot.countIn + slot.countOut, exceeds, structuredIn || structuredOut });
+            if (pending.size() >= batchSize)
+                emit();
+        }
+    }
+
+    void emit() {
+        if (pending.empty())
+            return;
+        if (sink)
+            sink(pending);
+        pending.clear();
+    }
+
+public:
+    CashReportingMonitor(AccountBook& accounts, Sink reportSink, const CustomerRegistry* customers = nullptr,
+        double threshold = 10000.0, double structuringFloor = 8000.0, int64_t businessDayOffsetSeconds = 0, size_t batch = 256)
+        : book(accounts), registry(customers), sink(move(reportSink)),
+        thresholdCents(llround(threshold * 100)), structuringFloorCents(llround(structuringFloor * 100)),
+        dayOffsetSeconds(businessDayOffsetSeconds), batchSize(batch) {
+        book.addObserver(this);
+    }
+
+    ~CashReportingMonitor() override { book.removeObserver(this); }
+    CashReportingMonitor(const CashReportingMonitor&) = delete;
+    CashReportingMonitor& operator=(const CashReportingMonitor&) = delete;
+
+    void onPosting(uint32_t account, PostingType type, PostingChannel channel, double amount, double, double, int64_t time) override {
+        if (channel != PostingChannel::Cash || (type != PostingType::Deposit && type != PostingType::Withdrawal))
+            return;
+        int64_t day = (time + dayOffsetSeconds) / 86400;
+        DailyCashTable* table = &today;
+        if (day != currentDay) {
+            if (currentDay >= 0 && day < currentDay) {
+                if (day != closedDay) {
+                    ++late;  // its day has already been reported
+                    return;
+                }
+                table = &closed;
+            }
+            else {
+                if (closedDay >= 0)
+                    endOfDay();  // the flush job missed a day; catch up before reusing the table
+                if (currentDay >= 0) {
+                    swap(today, closed);
+                    closedDay = currentDay;
+                }
+                currentDay = day;
+            }
+        }
+        uint32_t customer = registry ? registry->customerOf(account) : CustomerRegistry::none;
+        uint64_t key = customer == CustomerRegistry::none ? DailyCashTable::accountKey(account) : DailyCashTable::customerKey(customer);
+        int64_t cents = llround(amount * 100);
+        DailyCashTable::Slot& slot = table->find(key);
+        if (type == PostingType::Deposit) {
+            slot.centsIn += cents;
+            ++slot.countIn;
+            slot.largestIn = max(slot.largestIn, cents);
+        }
+        else {
+            slot.centsOut += cents;
+            ++slot.countOut;
+            slot.largestOut = max(slot.largestOut, cents);
+        }
+    }
+
+    /**
+     * End-of-day flush job: reports the most recently closed business day and
+     * releases its table. Run it after the cutoff; postings are never blocked on it.
+     */
+    void endOfDay() {
+        if (closedDay < 0)
+            return;
+        evaluate(closed, closedDay);
+        emit();
+        closed.clear();
+        closedDay = -1;
+    }
+
+    // Closes and reports the current day as well, e.g. at shutdown
+    void flushAll() {
+        endOfDay();
+        if (currentDay >= 0) {
+            evaluate(today, currentDay);
+            emit();
+            today.clear();
+        }
+    }
+
+    size_t customersToday() const { return today.size(); }
+
+    // Cash postings dated to a business day that was already reported
+    size_t latePostings() const { return late; }
+};
+
+/**
+ * Compressed sparse row graph of money flow between accounts, built from the
+ * TransferOut rows of a book's history. Repeated transfers between the same pair
+ * collapse into one edge carrying the summed amount and transfer count.
+ * refresh() reads and sorts only the log rows added since the previous call,
+ * but merging them rewrites the CSR arrays, so a refresh that adds edges costs
+ * O(existing edges + new rows) rather than O(new rows).
+ */
+class TransferGraph {
+public:
+    using AccountId = AccountBook::AccountId;
+
+private:
+    struct Edge {
+        AccountId from;
+        AccountId to;
+        double amount;
+    };
+
+    vector<uint64_t> offsets = vector<uint64_t>(1, 0);
+    vector<AccountId> targets;
+    vector<double> amounts;
+    vector<uint32_t> counts;
+    size_t logPosition = 0;
+
+    uint64_t edgeBegin(AccountId v) const { return v < vertexCount() ? offsets[v] : 0; }
+    uint64_t edgeEnd(AccountId v) const { return v < vertexCount() ? offsets[v + 1] : 0; }
+
+public:
+    void refresh(const AccountBook& book) {
+        const TransactionLog& log = book.getHistory();
+        vector<Edge> added;
+        for (size_t row = logPosition; row < log.size(); ++row) {
+            if (log.typeAt(row) == PostingType::TransferOut)
+                added.push_back({ log.accountAt(row), log.counterpartyAt(row), log.amountAt(row) });
+        }
+        logPosition = log.size();
+
+        size_t vertices = max(book.size(), vertexCount());
+        if (added.empty() && vertices == vertexCount())
+            return;
+        sort(added.begin(), added.end(), [](const Edge& a, const Edge& b) {
+            return a.from != b.from ? a.from < b.from : a.to < b.to;
+        });
+
+        vector<uint64_t> mergedOffsets(vertices + 1, 0);
+        vector<AccountId> mergedTargets;
+        vector<double> mergedAmounts;
+        vector<uint32_t> mergedCounts;
+        mergedTargets.reserve(targets.size() + added.size());
+        mergedAmounts.reserve(targets.size() + added.size());
+        mergedCounts.reserve(targets.size() + added.size());
+
+        size_t next = 0;
+        for (size_t v = 0; v < vertices; ++v) {
+            uint64_t rowStart = mergedTargets.size();
+            mergedOffsets[v] = rowStart;
+            uint64_t e = edgeBegin(static_cast<AccountId>(v));
+            uint64_t end = edgeEnd(static_cast<AccountId>(v));
+            while (true) {
+                bool haveOld = e < end;
+                bool haveNew = next < added.size() && added[next].from == v;
+                if (!haveOld && !haveNew)
+                    break;
+                AccountId target;
+                double amount;
+                uint32_t count;
+                if (haveNew && (!haveOld || added[next].to <= targets[e])) {
+                    target = added[next].to;
+                    amount = added[next].amount;
+                    count = 1;
+                    ++next;
+                }
+                else {
+                    target = targets[e];
+                    amount = amounts[e];
+                    count = counts[e];
+                    ++e;
+                }
+                if (mergedTargets.size() > rowStart && mergedTargets.back() == target) {
+                    mergedAmounts.back() += amount;
+                    mergedCounts.back() += count;
+                }
+                else {
+                    mergedTargets.push_back(target);
+                    mergedAmounts.push_back(amount);
+                    mergedCounts.push_back(count);
+                }
+            }
+        }
+        mergedOffsets[vertices] = mergedTargets.size();
+
+        offsets.swap(mergedOffsets);
+        targets.swap(mergedTargets);
+        amounts.swap(mergedAmounts);
+        counts.swap(mergedCounts);
+    }
+
+    size_t vertexCount() const { return offsets.size() - 1; }
+    size_t edgeCount() const { return targets.size(); }
+
+    /**
+     * Weakly connected components with a lock-free union-find.
+     * Edges are united in parallel; roots always link to the smaller id, so each
+     * account's label is the smallest account id in its component.
+     */
+    vector<AccountId> connectedComponents() const {
+        size_t n = vertexCount();
+        size_t workers = workerCount(n);
+        unique_ptr<atomic<AccountId>[]> parent(new atomic<AccountId>[n]);
+        parallelFor(n, workers, [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                parent[i].store(static_cast<AccountId>(i), memory_order_relaxed);
+        });
+
+        auto find = [&](AccountId x) {
+            while (true) {
+                AccountId p = parent[x].load(memory_order_relaxed);
+                if (p == x)
+                    return x;
+                AccountId grandparent = parent[p].load(memory_order_relaxed);
+                if (grandparent != p)
+                    parent[x].compare_exchange_weak(p, grandparent, memory_order_relaxed);
+                x = grandparent;
+            }
+        };
+
+        parallelFor(n, workers, [&](size_t, size_t begin, size_t end) {
+            for (size_t v = begin; v < end; ++v) {
+                for (uint64_t e = offsets[v]; e < offsets[v + 1]; ++e) {
+                    AccountId a = static_cast<AccountId>(v);
+                    AccountId b = targets[e];
+                    while (true) {
+                        a = find(a);
+                        b = find(b);
+                        if (a == b)
+                            break;
+                        if (a < b)
+                            swap(a, b);
+                        AccountId expected = a;
+                        if (parent[a].compare_exchange_strong(expected, b, memory_order_relaxed))
+                            break;
+                    }
+                }
+            }
+        });
+
+        vector<AccountId> labels(n);
+        parallelFor(n, workers, [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                labels[i] = find(static_cast<AccountId>(i));
+        });
+        return labels;
+    }
+
+    /**
+     * Accounts reachable from source along outgoing transfers, grouped by hop:
+     * levels[h] holds the accounts first reached after h + 1 transfers.
+     * Each level is expanded in parallel; a shared bitmap claims visited accounts.
+     */
+    vector<vector<AccountId>> fanOut(AccountId source, size_t hops) const {
+        size_t n = vertexCount();
+        unique_ptr<atomic<uint64_t>[]> visited(new atomic<uint64_t>[n / 64 + 1]);
+        for (size_t w = 0; w <= n / 64; ++w)
+            visited[w].store(0, memory_order_relaxed);
+        auto claim = [&](AccountId v) {
+            uint64_t bit = uint64_t(1) << (v % 64);
+            return (visited[v / 64].fetch_or(bit, memory_order_relaxed) & bit) == 0;
+        };
+
+        vector<vector<AccountId>> levels;
+        vector<AccountId> frontier;
+        if (source < n && claim(source))
+            frontier.push_back(source);
+        for (size_t h = 0; h < hops && !frontier.empty(); ++h) {
+            size_t workers = workerCount(frontier.size(), 4096);
+            vector<vector<AccountId>> found(workers);
+            parallelFor(frontier.size(), workers, [&](size_t worker, size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    AccountId v = frontier[i];
+                    for (uint64_t e = offsets[v]; e < offsets[v + 1]; ++e) {
+                        if (claim(targets[e]))
+                            found[worker].push_back(targets[e]);
+                    }
+                }
+            });
+            frontier.clear();
+            for (auto& part : found)
+                frontier.insert(frontier.end(), part.begin(), part.end());
+            levels.push_back(frontier);
+        }
+        if (!levels.empty() && levels.back().empty())
+            levels.pop_back();
+        return levels;
+    }
+
+    /**
+     * Directed transfer cycles of 2 to maxLength accounts, at most limit of them.
+     * Each cycle is reported once, starting from its smallest account id, so the
+     * search from every start account only visits larger ids and runs in parallel.
+     */
+    vector<vector<AccountId>> findCycles(size_t maxLength, size_t limit) const {
+        size_t n = vertexCount();
+        size_t workers = workerCount(n, 1024);
+        atomic<size_t> reported(0);
+        vector<vector<vector<AccountId>>> found(workers);
+
+        parallelFor(n, workers, [&](size_t worker, size_t begin, size_t end) {
+            vector<AccountId> path;
+            vector<uint64_t> cursor;
+            for (size_t start = begin; start < end && reported.load(memory_order_relaxed) < limit; ++start) {
+                path.assign(1, static_cast<AccountId>(start));
+                cursor.assign(1, offsets[start]);
+                while (!path.empty()) {
+                    AccountId v = path.back();
+                    if (cursor.back() == offsets[v + 1]) {
+                        path.pop_back();
+                        cursor.pop_back();
+                        continue;
+                    }
+                    AccountId next = targets[cursor.back()++];
+                    if (next == start && path.size() >= 2) {
+                        if (reported.fetch_add(1, memory_order_relaxed) >= limit)
+                            break;
+                        found[worker].push_back(path);
+                    }
+                    else if (next > start && path.size() < maxLength
+                        && find(path.begin(), path.end(), next) == path.end()) {
+                        path.push_back(next);
+                        cursor.push_back(offsets[next]);
+                    }
+                }
+            }
+        });
+
+        vector<vector<AccountId>> cycles;
+        for (auto& part : found)
+            for (auto& cycle : part)
+                cycles.push_back(move(cycle));
+        if (cycles.size() > limit)
+            cycles.resize(limit);
+        return cycles;
+    }
+};
+
+/**
+ * Read-only memory mapping of a whole file.
+ */
+class MappedFile {
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int descriptor = -1;
+#endif
+
+public:
+    explicit MappedFile(const string& path) {
+#if defined(_WIN32)
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        LARGE_INTEGER fileSize;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize))
+            throw runtime_error("Cannot open " + path);
+        length = static_cast<size_t>(fileSize.QuadPart);
+        if (length > 0) {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            bytes = mapping ? static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+            if (!bytes) {
+                if (mapping) CloseHandle(mapping);
+                CloseHandle(file);
+                throw runtime_error("Cannot map " + path);
+            }
+        }
+#else
+        descriptor = open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (descriptor < 0 || fstat(descriptor, &info) != 0) {
+            if (descriptor >= 0) close(descriptor);
+            throw runtime_error("Cannot open " + path);
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length > 0) {
+            void* view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (view == MAP_FAILED) {
+                close(descriptor);
+                throw runtime_error("Cannot map " + path);
+            }
+            madvise(view, length, MADV_SEQUENTIAL);
+            bytes = static_cast<const char*>(view);
+        }
+#endif
+    }
+
+    ~MappedFile() {
+#if defined(_WIN32)
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (bytes) munmap(const_cast<char*>(bytes), length);
+        if (descriptor >= 0) close(descriptor);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+/**
+ * Streaming NACHA (ACH) file processor.
+ *
+ * The file is memory-mapped and walked as fixed 94-character records (with or
+ * without CR/LF terminators). A first pass only looks at each record's type byte
+ * to find batch boundaries and check the file control record against the batch
+ * control totals; a file that fails that check is rejected whole. Batches are then
+ * parsed and validated in parallel a window at a time, and the entries of every
+ * valid batch are posted through AccountBook::postBulk, one call per batch.
+ * Numeric fields sit at fixed offsets and are decoded eight digits at a time with
+ * SWAR arithmetic on one 64-bit load.
+ *
+ * Validation checks entry/addenda counts, the entry hash (sum of the 8-digit RDFI
+ * routing numbers, mod 10^10) and debit/credit totals against each batch control
+ * record, and the same totals against the file control record.
+ * Entry transaction codes 22/32 credit and 27/37 debit checking/savings accounts;
+ * prenotes (23, 28, 33, 38) are validated but not posted. The DFI account number
+ * field carries the book's account id.
+ */
+class AchFileProcessor {
+public:
+    static constexpr size_t recordLength = 94;
+
+    struct BatchResult {
+        uint32_t batchNumber = 0;
+        size_t entries = 0;
+        bool valid = false;
+        string error;
+        vector<Posting> postings;
+    };
+
+    struct Report {
+        size_t bytes = 0;
+        size_t batches = 0;
+        size_t invalidBatches = 0;
+        size_t posted = 0;
+        size_t rejected = 0;
+        int64_t debitCents = 0;
+        int64_t creditCents = 0;
+        bool fileControlValid = false;
+        vector<string> errors;
+        double seconds = 0;
+    };
+
+private:
+    // Eight ASCII digits from one unaligned 64-bit load; assumes a little-endian host
+    static bool parse8(const char* text, uint64_t& value) {
+        uint64_t chunk;
+        memcpy(&chunk, text, 8);
+        if ((chunk & 0xF0F0F0F0F0F0F0F0ull) != 0x3030303030303030ull
+            || ((chunk + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) != 0x3030303030303030ull)
+            return false;
+        chunk -= 0x3030303030303030ull;
+        chunk = chunk * 10 + (chunk >> 8);
+        chunk = (((chunk & 0x000000FF000000FFull) * (100 + (1000000ull << 32)))
+            + (((chunk >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+        value = chunk;
+        return true;
+    }
+
+    static bool parseDigits(const char* text, size_t count, uint64_t& value) {
+        value = 0;
+        while (count >= 8) {
+            uint64_t part;
+            if (!parse8(text, part)) return false;
+            value = value * 100000000ull + part;
+            text += 8;
+            count -= 8;
+        }
+        for (; count > 0; --count, ++text) {
+            if (*text < '0' || *text > '9') return false;
+            value = value * 10 + static_cast<uint64_t>(*text - '0');
+        }
+        return true;
+    }
+
+    static BatchResult parseBatch(const char* data, size_t stride, size_t first, size_t last) {
+        BatchResult batch;
+        const char* header = data + first * stride;
+        const char* control = data + last * stride;
+        uint64_t headerBatch = 0, controlBatch = 0;
+        parseDigits(header + 87, 7, headerBatch);
+        batch.batchNumber = static_cast<uint32_t>(headerBatch);
+        if (control[0] != '8') {
+            batch.error = "missing batch control record";
+            return batch;
+        }
+
+        uint64_t entryHash = 0, debits = 0, credits = 0, counted = 0;
+        for (size_t r = first + 1; r < last; ++r) {
+            const char* record = data + r * stride;
+            if (record[0] == '7') {
+                ++counted;
+                continue;
+            }
+            if (record[0] != '6') {
+                batch.error = string("unexpected record type ") + record[0] + " in batch";
+                return batch;
+            }
+            ++counted;
+            uint64_t code, routing, account, cents;
+            if (!parseDigits(record + 1, 2, code) || !parseDigits(record + 3, 8, routing)
+                || !parseDigits(record + 29, 10, cents)) {
+                batch.error = "malformed entry detail record " + to_string(r + 1);
+                return batch;
+            }
+            entryHash += routing;
+            bool debit = code == 27 || code == 37 || code == 28 || code == 38;
+            bool credit = code == 22 || code == 32 || code == 23 || code == 33;
+            if (!debit && !credit) {
+                batch.error = "unsupported transaction code " + to_string(code);
+                return batch;
+            }
+            (debit ? debits : credits) += cents;
+            bool prenote = code % 10 == 3 || code % 10 == 8;
+            if (prenote)
+                continue;
+            // DFI account number: 17 characters, left-justified and space-padded
+            size_t digits = 0;
+            while (digits < 17 && record[12 + digits] != ' ') ++digits;
+            if (digits == 0 || digits > 10 || !parseDigits(record + 12, digits, account) || account > 0xFFFFFFFEull)
+                account = 0xFFFFFFFFull;  // rejected by postBulk as an unknown account
+            double amount = static_cast<double>(cents) / 100.0;
+            batch.postings.push_back({ static_cast<uint32_t>(account), debit ? -amount : amount });
+            ++batch.entries;
+        }
+
+        uint64_t controlCount, controlHash, controlDebits, controlCredits;
+        if (!parseDigits(control + 4, 6, controlCount) || !parseDigits(control + 10, 10, controlHash)
+            || !parseDigits(control + 20, 12, controlDebits) || !parseDigits(control + 32, 12, controlCredits)
+            || !parseDigits(control + 87, 7, controlBatch)) {
+            batch.error = "malformed batch control record";
+        }
+        else if (controlBatch != headerBatch) batch.error = "batch number mismatch";
+        else if (controlCount != counted) batch.error = "entry/addenda count mismatch";
+        else if (controlHash != entryHash % 10000000000ull) batch.error = "entry hash mismatch";
+        else if (controlDebits != debits || controlCredits != credits) batch.error = "batch total mismatch";
+        else batch.valid = true;
+        return batch;
+    }
+
+public:
+    static Report process(const string& path, AccountBook& book, int64_t now) {
+        auto start = chrono::steady_clock::now();
+        MappedFile file(path);
+        const char* data = file.data();
+        Report report;
+        report.bytes = file.size();
+        if (report.bytes < recordLength || data[0] != '1')
+            throw runtime_error("Not an ACH file: " + path);
+
+        char terminator = report.bytes > recordLength ? data[recordLength] : ' ';
+        size_t stride = terminator == '\r' ? recordLength + 2 : terminator == '\n' ? recordLength + 1 : recordLength;
+        size_t records = (report.bytes + stride - recordLength) / stride;
+
+        // Boundary pass: batch header/control positions and the file control record
+        vector<pair<size_t, size_t>> batches;
+        size_t fileControl = records;
+        for (size_t r = 1; r < records && fileControl == records; ++r) {
+            char type = data[r * stride];
+            if (type == '5') batches.push_back({ r, r });
+            else if (type == '8' && !batches.empty()) batches.back().second = r;
+            else if (type == '9') fileControl = r;
+        }
+
+        // File totals come straight from the batch control records, so the file control
+        // record is checked before any entry is parsed or posted
+        uint64_t entryHash = 0, entryCount = 0, debits = 0, credits = 0;
+        for (const auto& range : batches) {
+            uint64_t count = 0, hash = 0, debit = 0, credit = 0;
+            const char* control = data + range.second * stride;
+            if (range.second != range.first && parseDigits(control + 4, 6, count) && parseDigits(control + 10, 10, hash)
+                && parseDigits(control + 20, 12, debit) && parseDigits(control + 32, 12, credit)) {
+                entryCount += count;
+                entryHash += hash;
+                debits += debit;
+                credits += credit;
+            }
+        }
+        report.debitCents = static_cast<int64_t>(debits);
+        report.creditCents = static_cast<int64_t>(credits);
+        report.batches = batches.size();
+        if (fileControl == records) {
+            report.errors.push_back("missing file control record");
+        }
+        else {
+            const char* control = data + fileControl * stride;
+            uint64_t batchCount, count, hash, debit, credit;
+            report.fileControlValid = parseDigits(control + 1, 6, batchCount) && parseDigits(control + 13, 8, count)
+                && parseDigits(control + 21, 10, hash) && parseDigits(control + 31, 12, debit)
+                && parseDigits(control + 43, 12, credit) && batchCount == batches.size() && count == entryCount
+                && hash == entryHash % 10000000000ull && debit == debits && credit == credits;
+            if (!report.fileControlValid)
+                report.errors.push_back("file control totals do not match batches");
+        }
+        // A file whose control record is missing or wrong is rejected as a unit
+        if (!report.fileControlValid) {
+            report.errors.push_back("file rejected, nothing posted");
+            report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            return report;
+        }
+
+        // Batches are parsed a window at a time across cores and posted in file order,
+        // so memory stays bounded by the window rather than the file
+        size_t window = max<size_t>(1, workerCount(batches.size(), 1) * 4);
+        vector<BatchResult> results;
+        for (size_t first = 0; first < batches.size(); first += window) {
+            size_t count = min(window, batches.size() - first);
+            results.assign(count, BatchResult());
+            parallelFor(count, workerCount(count, 1), [&](size_t, size_t begin, size_t end) {
+                for (size_t b = begin; b < end; ++b) {
+                    const auto& range = batches[first + b];
+                    if (range.second == range.first) {
+                        results[b].error = "missing batch control record";
+                        continue;
+                    }
+                    results[b] = parseBatch(data, stride, range.first, range.second);
+                }
+            });
+            for (auto& batch : results) {
+                if (!batch.valid) {
+                    ++report.invalidBatches;
+                    report.errors.push_back("batch " + to_string(batch.batchNumber) + ": " + batch.error);
+                    continue;
+                }
+                BulkPostResult posted = book.postBulk(move(batch.postings), now);
+                report.posted += posted.posted;
+                report.rejected += posted.rejected.size();
+            }
+        }
+        report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return report;
+    }
+
+    /**
+     * Writes a well-formed ACH file of alternating credits and debits, for
+     * benchmarks and demonstrations.
+     */
+    static void writeSample(const string& path, size_t batchCount, size_t entriesPerBatch, uint32_t accounts) {
+        ofstream out(path, ios::binary);
+        if (!out)
+            throw runtime_error("Cannot write " + path);
+        auto field = [](uint64_t value, int width) {
+            ostringstream stream;
+            stream << setw(width) << setfill('0') << value;
+            return stream.str();
+        };
+        auto pad = [](string text, size_t width) { text.resize(width, ' '); return text; };
+        auto emit = [&](const string& record) { out << pad(record, recordLength) << "\n"; };
+
+        emit("101 091000019 1234567890" + string("2601010000A094101") + pad("BANK", 23) + pad("ORIGIN", 23) + pad("", 8));
+        uint64_t fileCount = 0, fileHash = 0, fileDebits = 0, fileCredits = 0;
+        for (size_t b = 0; b < batchCount; ++b) {
+            emit("5200" + pad("PAYROLL CO", 16) + pad("", 20) + "1234567890PPDPAYROLL   260101260101   1" + "09100001" + field(b + 1, 7));
+            uint64_t hash = 0, debits = 0, credits = 0;
+            for (size_t e = 0; e < entriesPerBatch; ++e) {
+                uint32_t account = static_cast<uint32_t>((b * entriesPerBatch + e) % accounts);
+                bool debit = e % 4 == 3;
+                bool savings = account % 2 == 0;
+                uint64_t cents = 1000 + (e % 97) * 25;
+                uint64_t routing = 9100001 + e % 7;
+                hash += routing;
+                (debit ? debits : credits) += cents;
+                string code = debit ? (savings ? "37" : "27") : (savings ? "32" : "22");
+                emit("6" + code + field(routing, 8) + "0" + pad(to_string(account), 17) + field(cents, 10)
+                    + pad("ID" + to_string(e), 15) + pad("EMPLOYEE", 22) + "  0" + "091000010000001");
+            }
+            emit("8200" + field(entriesPerBatch, 6) + field(hash % 10000000000ull, 10) + field(debits, 12)
+                + field(credits, 12) + "1234567890" + pad("", 25) + "09100001" + field(b + 1, 7));
+            fileCount += entriesPerBatch;
+            fileHash += hash;
+            fileDebits += debits;
+            fileCredits += credits;
+        }
+        emit("9" + field(batchCount, 6) + field((batchCount * (entriesPerBatch + 2) + 2 + 9) / 10, 6)
+            + field(fileCount, 8) + field(fileHash % 10000000000ull, 10) + field(fileDebits, 12) + field(fileCredits, 12));
+    }
+};
+
+constexpr size_t AchFileProcessor::recordLength;
+
+/**
+ * Blocking FIFO with a fixed capacity, used to hand batches between pipeline stages.
+ * close() wakes every waiter; pop() keeps draining until the queue is empty.
+ */
+template <typename T>
+class BoundedQueue {
+private:
+    mutex guard;
+    condition_variable notEmpty;
+    condition_variable notFull;
+    deque<T> items;
+    size_t capacity;
+    size_t highWater = 0;
+    bool closed = false;
+
+public:
+    explicit BoundedQueue(size_t limit) : capacity(max<size_t>(1, limit)) {}
+
+    bool push(T item) {
+        unique_lock<mutex> lock(guard);
+        notFull.wait(lock, [&]() { return closed || items.size() < capacity; });
+        if (closed)
+            return false;
+        items.push_back(move(item));
+        highWater = max(highWater, items.size());
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item) {
+        unique_lock<mutex> lock(guard);
+        notEmpty.wait(lock, [&]() { return closed || !items.empty(); });
+        if (items.empty())
+            return false;
+        item = move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> lock(guard);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+    size_t depth() {
+        lock_guard<mutex> lock(guard);
+        return items.size();
+    }
+
+    size_t maxDepth() {
+        lock_guard<mutex> lock(guard);
+        return highWater;
+    }
+};
+
+/**
+ * Streaming reader for ISO 20022 pain.001 customer credit transfer files.
+ *
+ * A byte-level state machine reads the input in fixed 64 KB chunks without
+ * building a DOM. It keeps only a stack of recognised element tags, and copies
+ * text only for the few leaves it needs:
+ *   PmtInf/DbtrAcct/Id/Othr/Id          debtor account (shared by the PmtInf)
+ *   CdtTrfTxInf/Amt/InstdAmt (@Ccy)     amount and currency
+ *   CdtTrfTxInf/CdtrAcct/Id/Othr/Id     creditor account
+ *   CdtTrfTxInf/PmtId/EndToEndId
+ * Namespace prefixes are ignored. Account identifiers must be numeric book ids;
+ * anything else (such as an IBAN) is carried as an invalid account.
+ */
+class Pain001Reader {
+public:
+    static constexpr uint32_t invalidAccount = 0xFFFFFFFFu;
+
+    struct Transfer {
+        uint32_t debtor;
+        uint32_t creditor;
+        int64_t cents;
+        char currency[4];
+        char endToEndId[36];
+    };
+
+private:
+    enum Tag : uint8_t { Other, PmtInf, DbtrAcct, CdtTrfTxInf, CdtrAcct, Id, Othr, InstdAmt, EndToEndId };
+
+    istream& in;
+    vector<char> buffer = vector<char>(1 << 16);
+    size_t position = 0;
+    size_t filled = 0;
+    bool inTag = false;
+    string tag;
+    string text;
+    bool capturing = false;
+    vector<Tag> path;
+    uint32_t debtor = invalidAccount;
+    Transfer current{};
+
+    static Tag classify(const char* name, size_t length) {
+        struct Known { const char* name; Tag tag; };
+        static const Known known[] = {
+            { "PmtInf", PmtInf }, { "DbtrAcct", DbtrAcct }, { "CdtTrfTxInf", CdtTrfTxInf }, { "CdtrAcct", CdtrAcct },
+            { "Id", Id }, { "Othr", Othr }, { "InstdAmt", InstdAmt }, { "EndToEndId", EndToEndId } };
+        for (const auto& entry : known) {
+            if (strlen(entry.name) == length && memcmp(entry.name, name, length) == 0)
+                return entry.tag;
+        }
+        return Other;
+    }
+
+    bool pathEndsWith(initializer_list<Tag> suffix) const {
+        if (suffix.size() > path.size())
+            return false;
+        return equal(suffix.begin(), suffix.end(), path.end() - suffix.size());
+    }
+
+    static uint32_t parseAccount(const string& value) {
+        if (value.empty() || value.size() > 10)
+            return invalidAccount;
+        uint64_t id = 0;
+        for (char c : value) {
+            if (c < '0' || c > '9')
+                return invalidAccount;
+            id = id * 10 + static_cast<uint64_t>(c - '0');
+        }
+        return id < invalidAccount ? static_cast<uint32_t>(id) : invalidAccount;
+    }
+
+    // "1234.5" -> 123450; -1 when malformed or too large for int64 cents
+    static int64_t parseCents(const string& value) {
+        int64_t cents = 0;
+        int decimals = -1;
+        size_t digits = 0;
+        for (char c : value) {
+            if (c == '.' && decimals < 0) { decimals = 0; continue; }
+            if (c < '0' || c > '9' || decimals >= 2) return -1;
+            int digit = c - '0';
+            if (cents > (INT64_MAX - digit) / 10) return -1;
+            cents = cents * 10 + digit;
+            ++digits;
+            if (decimals >= 0) ++decimals;
+        }
+        for (int d = max(decimals, 0); d < 2; ++d) {
+            if (cents > INT64_MAX / 10) return -1;
+            cents *= 10;
+        }
+        return digits == 0 ? -1 : cents;
+    }
+
+    void startElement() {
+        size_t nameStart = 0;
+        size_t nameEnd = 0;
+        while (nameEnd < tag.size() && !isspace(static_cast<unsigned char>(tag[nameEnd])) && tag[nameEnd] != '/') {
+            if (tag[nameEnd] == ':') nameStart = nameEnd + 1;
+            ++nameEnd;
+        }
+        Tag element = classify(tag.data() + nameStart, nameEnd - nameStart);
+        path.push_back(element);
+        text.clear();
+        capturing = element == Id || element == InstdAmt || element == EndToEndId;
+        if (element == PmtInf)
+            debtor = invalidAccount;
+        else if (element == CdtTrfTxInf)
+            current = Transfer{ invalidAccount, invalidAccount, -1, "", "" };
+        else if (element == InstdAmt) {
+            size_t ccy = tag.find("Ccy=");
+            if (ccy != string::npos && ccy + 8 <= tag.size()) {
+                memcpy(current.currency, tag.data() + ccy + 5, 3);
+                current.currency[3] = '\0';
+            }
+        }
+    }
+
+    // Returns true when a complete transfer was produced
+    bool endElement() {
+        if (path.empty())
+            return false;
+        bool produced = false;
+        if (pathEndsWith({ DbtrAcct, Id, Othr, Id }))
+            debtor = parseAccount(text);
+        else if (pathEndsWith({ CdtrAcct, Id, Othr, Id }))
+            current.creditor = parseAccount(text);
+        else if (path.back() == InstdAmt)
+            current.cents = parseCents(text);
+        else if (path.back() == EndToEndId) {
+            size_t length = min(text.size(), sizeof(current.endToEndId) - 1);
+            memcpy(current.endToEndId, text.data(), length);
+            current.endToEndId[length] = '\0';
+        }
+        else if (path.back() == CdtTrfTxInf) {
+            current.debtor = debtor;
+            produced = true;
+        }
+        path.pop_back();
+        capturing = false;
+        return produced;
+    }
+
+public:
+    explicit Pain001Reader(istream& input) : in(input) {
+        tag.reserve(256);
+        text.reserve(64);
+    }
+
+    /**
+     * Appends up to maxTransfers transfers to batch; returns false once the input
+     * is exhausted and nothing was added.
+     */
+    bool next(vector<Transfer>& batch, size_t maxTransfers) {
+        size_t start = batch.size();
+        while (batch.size() - start < maxTransfers) {
+            if (position == filled) {
+                in.read(buffer.data(), static_cast<streamsize>(buffer.size()));
+                filled = static_cast<size_t>(in.gcount());
+                position = 0;
+                if (filled == 0)
+                    break;
+            }
+            char c = buffer[position++];
+            if (!inTag) {
+                if (c == '<') {
+                    inTag = true;
+                    tag.clear();
+                }
+                else if (capturing && !isspace(static_cast<unsigned char>(c))) {
+                    text.push_back(c);
+                }
+                continue;
+            }
+            if (c != '>') {
+                tag.push_back(c);
+                continue;
+            }
+            // Comments may contain '>', so they end only at "-->"
+            if (tag.compare(0, 3, "!--") == 0 && (tag.size() < 5 || tag.compare(tag.size() - 2, 2, "--") != 0)) {
+                tag.push_back(c);
+                continue;
+            }
+            inTag = false;
+            if (tag.empty() || tag[0] == '?' || tag[0] == '!')
+                continue;
+            if (tag[0] == '/') {
+                if (endElement())
+                    batch.push_back(current);
+            }
+            else {
+                startElement();
+                if (tag.back() == '/' && endElement())
+                    batch.push_back(current);
+            }
+        }
+        return batch.size() > start;
+    }
+};
+
+constexpr uint32_t Pain001Reader::invalidAccount;
+
+/**
+ * Three-stage pain.001 pipeline: a parser thread, a validation thread and the
+ * calling thread as the only writer to the book. Batches move between stages
+ * through bounded queues, so parsing, validation and posting overlap while
+ * memory stays bounded.
+ */
+class Pain001Processor {
+public:
+    struct Report {
+        size_t transactions = 0;
+        size_t posted = 0;
+        size_t rejected = 0;   // failed validation: amount, currency or accounts
+        size_t declined = 0;   // refused by the book's withdrawal rules
+        size_t batches = 0;
+        size_t maxParsedDepth = 0;
+        size_t maxValidatedDepth = 0;
+        double postedAmount = 0;
+        double seconds = 0;
+    };
+
+    static Report process(istream& input, AccountBook& book, int64_t now,
+        const char* currency = "USD", size_t batchSize = 4096, size_t queueDepth = 8) {
+        using Batch = vector<Pain001Reader::Transfer>;
+        auto start = chrono::steady_clock::now();
+        BoundedQueue<Batch> parsed(queueDepth);
+        BoundedQueue<Batch> validated(queueDepth);
+        MetricsGauge parsedDepth("bank_queue_depth{queue=\"pain001_parsed\"}", "Batches waiting in a pipeline queue.",
+            [&parsed]() { return static_cast<double>(parsed.depth()); });
+        MetricsGauge validatedDepth("bank_queue_depth{queue=\"pain001_validated\"}", "Batches waiting in a pipeline queue.",
+            [&validated]() { return static_cast<double>(validated.depth()); });
+        atomic<size_t> transactions(0);
+        atomic<size_t> rejected(0);
+        const size_t accounts = book.size();
+
+        // A stage that throws records the first failure and closes both queues, so the
+        // other stages drain and stop; the failure is rethrown once every thread is joined
+        mutex failureGuard;
+        exception_ptr failure;
+        auto fail = [&]() {
+            {
+                lock_guard<mutex> lock(failureGuard);
+                if (!failure) failure = current_exception();
+            }
+            parsed.close();
+            validated.close();
+        };
+
+        thread parser([&]() {
+            SamplingProfiler::ThreadClass name("pain001-parser");
+            try {
+                Pain001Reader reader(input);
+                Batch batch;
+                batch.reserve(batchSize);
+                while (reader.next(batch, batchSize)) {
+                    transactions += batch.size();
+                    if (!parsed.push(move(batch)))
+                        break;
+                    batch = Batch();
+                    batch.reserve(batchSize);
+                }
+                parsed.close();
+            }
+            catch (...) {
+                fail();
+            }
+        });
+
+        thread validator([&]() {
+            SamplingProfiler::ThreadClass name("pain001-validator");
+            try {
+                Batch batch;
+                while (parsed.pop(batch)) {
+                    size_t kept = 0;
+                    for (const auto& transfer : batch) {
+                        bool valid = transfer.cents > 0 && strcmp(transfer.currency, currency) == 0
+                            && transfer.debtor < accounts && transfer.creditor < accounts
+                            && transfer.debtor != transfer.creditor;
+                        if (valid) batch[kept++] = transfer;
+                    }
+                    rejected += batch.size() - kept;
+                    batch.resize(kept);
+                    if (!validated.push(move(batch)))
+                        break;
+                }
+                validated.close();
+            }
+            catch (...) {
+                fail();
+            }
+        });
+
+        Report report;
+        try {
+            Batch batch;
+            while (validated.pop(batch)) {
+                ++report.batches;
+                for (const auto& transfer : batch) {
+                    double amount = transfer.cents / 100.0;
+                    try {
+                        book.transfer(transfer.debtor, transfer.creditor, amount, now);
+                        ++report.posted;
+                        report.postedAmount += amount;
+                    }
+                    catch (const runtime_error&) {
+                        ++report.declined;
+                    }
+                }
+            }
+        }
+        catch (...) {
+            fail();
+        }
+        parser.join();
+        validator.join();
+        if (failure)
+            rethrow_exception(failure);
+
+        report.transactions = transactions;
+        report.rejected = rejected;
+        report.maxParsedDepth = parsed.maxDepth();
+        report.maxValidatedDepth = validated.maxDepth();
+        report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return report;
+    }
+
+    // Writes a pain.001.001.09 file with one payment block per 1000 transactions
+    static void writeSample(ostream& out, size_t transactions, uint32_t accounts) {
+        out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            << "<Document xmlns=\"urn:iso:std:iso:20022:tech:xsd:pain.001.001.09\"><CstmrCdtTrfInitn>\n"
+            << "<GrpHdr><MsgId>SAMPLE</MsgId><NbOfTxs>" << transactions << "</NbOfTxs></GrpHdr>\n";
+        for (size_t i = 0; i < transactions; ++i) {
+            if (i % 1000 == 0) {
+                if (i) out << "</PmtInf>\n";
+                out << "<PmtInf><PmtInfId>P" << i / 1000 << "</PmtInfId><Dbtr><Nm>Corporate Client</Nm></Dbtr>"
+                    << "<DbtrAcct><Id><Othr><Id>" << (i / 1000) % accounts << "</Id></Othr></Id></DbtrAcct>\n";
+            }
+            out << "<CdtTrfTxInf><PmtId><EndToEndId>E2E" << i << "</EndToEndId></PmtId>"
+                << "<Amt><InstdAmt Ccy=\"USD\">" << 1 + i % 50 << "." << setw(2) << setfill('0') << i % 100 << setfill(' ')
+                << "</InstdAmt></Amt><Cdtr><Nm>Payee " << i << "</Nm></Cdtr>"
+                << "<CdtrAcct><Id><Othr><Id>" << (i * 7919 + 1) % accounts << "</Id></Othr></Id></CdtrAcct></CdtTrfTxInf>\n";
+        }
+        if (transactions) out << "</PmtInf>\n";
+        out << "</CstmrCdtTrfInitn></Document>\n";
+    }
+};
+
+/**
+ * Space-Saving top-K sketch (Metwally et al.) of the keys with the most events.
+ * Any key whose true count exceeds total/K is guaranteed to be tracked, and each
+ * entry's count overestimates the truth by at most its error. Not thread-safe.
+ */
+class HeavyHitters {
+public:
+    struct Entry {
+        uint64_t key;
+        uint64_t count;
+        uint64_t error;
+        uint64_t weight;   // summed payload, such as wait nanoseconds
+    };
+
+private:
+    vector<Entry> entries;
+    size_t capacity;
+
+public:
+    explicit HeavyHitters(size_t k = 32) : capacity(max<size_t>(1, k)) { entries.reserve(capacity); }
+
+    void add(uint64_t key, uint64_t weight = 0) {
+        for (auto& entry : entries) {
+            if (entry.key == key) {
+                ++entry.count;
+                entry.weight += weight;
+                return;
+            }
+        }
+        if (entries.size() < capacity) {
+            entries.push_back({ key, 1, 0, weight });
+            return;
+        }
+        // Evict the smallest counter; the newcomer inherits its count as error
+        auto smallest = min_element(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b) { return a.count < b.count; });
+        *smallest = { key, smallest->count + 1, smallest->count, weight };
+    }
+
+    vector<Entry> top(size_t k) const {
+        vector<Entry> sorted(entries);
+        sort(sorted.begin(), sorted.end(), [](const Entry& a, const Entry& b) { return a.count > b.count; });
+        if (sorted.size() > k)
+            sorted.resize(k);
+        return sorted;
+    }
+
+    void clear() { entries.clear(); }
+};
+
+/**
+ * Fixed pool of mutexes striped over object keys, so worker threads can lock
+ * accounts without a mutex inside every account object.
+ * Each stripe carries its own contention statistics, which are only written by
+ * the thread holding that stripe and so need no synchronization of their own.
+ * Wait time is measured only when try_lock fails; hold time is sampled on every
+ * contended acquisition and on one in holdSampleEvery uncontended ones. Contended
+ * keys also feed a heavy-hitter sketch behind its own mutex, which only threads
+ * that already had to block ever touch.
+ */
+class StripedLocks {
+public:
+    static constexpr uint64_t holdSampleEvery = 64;
+
+    struct StripeStats {
+        uint64_t acquisitions = 0;
+        uint64_t contended = 0;
+        uint64_t waitNanos = 0;
+        uint64_t holdSamples = 0;
+        uint64_t holdNanos = 0;
+    };
+
+    struct Report {
+        StripeStats total;
+        vector<pair<size_t, StripeStats>> hottestStripes;
+        vector<HeavyHitters::Entry> hottestKeys;
+    };
+
+private:
+    struct Stripe {
+        mutex lock;
+        StripeStats stats;
+    };
+
+    vector<Stripe> stripes;
+    mutex sketchGuard;
+    HeavyHitters sketch;
+
+public:
+    explicit StripedLocks(size_t count = 1024, size_t trackedKeys = 32) : stripes(count), sketch(trackedKeys) {}
+
+    size_t stripeOf(uint64_t key) const { return static_cast<size_t>(key % stripes.size()); }
+    mutex& stripe(size_t index) { return stripes[index].lock; }
+    size_t size() const { return stripes.size(); }
+
+    // Call only while holding the stripe
+    StripeStats& statsOf(size_t index) { return stripes[index].stats; }
+
+    void recordContention(uint64_t key, uint64_t waitNanos) {
+        lock_guard<mutex> lock(sketchGuard);
+        sketch.add(key, waitNanos);
+    }
+
+    // Snapshot on demand; briefly takes each stripe in turn
+    Report report(size_t top = 10) {
+        Report result;
+        for (size_t i = 0; i < stripes.size(); ++i) {
+            StripeStats stats;
+            {
+                lock_guard<mutex> lock(stripes[i].lock);
+                stats = stripes[i].stats;
+            }
+            result.total.acquisitions += stats.acquisitions;
+            result.total.contended += stats.contended;
+            result.total.waitNanos += stats.waitNanos;
+            result.total.holdSamples += stats.holdSamples;
+            result.total.holdNanos += stats.holdNanos;
+            if (stats.contended)
+                result.hottestStripes.emplace_back(i, stats);
+        }
+        sort(result.hottestStripes.begin(), result.hottestStripes.end(),
+            [](const pair<size_t, StripeStats>& a, const pair<size_t, StripeStats>& b) { return a.second.waitNanos > b.second.waitNanos; });
+        if (result.hottestStripes.size() > top)
+            result.hottestStripes.resize(top);
+        lock_guard<mutex> lock(sketchGuard);
+        result.hottestKeys = sketch.top(top);
+        return result;
+    }
+
+    // Prints the report with keys shown through label, e.g. to undo key namespacing
+    void printReport(ostream& out, size_t top, function<string(uint64_t)> label) {
+        if (!Instrumentation::lockProfiling) {
+            out << "  lock profiling is compiled out at instrumentation level " << Instrumentation::level << "\n";
+            return;
+        }
+        Report result = report(top);
+        const StripeStats& total = result.total;
+        out << "  lock acquisitions: " << total.acquisitions << ", contended " << total.contended
+            << fixed << setprecision(3) << " (" << 100.0 * total.contended / max<uint64_t>(1, total.acquisitions) << "%)"
+            << setprecision(2) << ", mean wait " << total.waitNanos / 1e3 / max<uint64_t>(1, total.contended) << " us"
+            << ", mean hold " << total.holdNanos / 1e3 / max<uint64_t>(1, total.holdSamples) << " us\n";
+        for (const auto& entry : result.hottestKeys)
+            out << "    " << left << setw(20) << label(entry.key) << right << setw(10) << entry.count << " waits (+/-"
+                << entry.error << ")" << setw(12) << entry.weight / 1e3 / entry.count << " us mean wait\n";
+    }
+};
+
+constexpr uint64_t StripedLocks::holdSampleEvery;
+
+/**
+ * Holds the stripes for up to four keys, locked in ascending stripe order so that
+ * multi-account transactions cannot deadlock.
+ */
+class StripeGuard {
+private:
+    StripedLocks& locks;
+    size_t held[4];
+    uint64_t keyOf[4];
+    chrono::steady_clock::time_point acquiredAt[4];
+    bool sampled[4];
+    size_t count = 0;
+
+public:
+    StripeGuard(StripedLocks& table, initializer_list<uint64_t> keys) : locks(table) {
+        if (keys.size() > 4)
+            throw invalid_argument("StripeGuard holds at most four keys");
+        // Insertion into a sorted, de-duplicated list of at most four stripes
+        for (uint64_t key : keys) {
+            size_t stripe = locks.stripeOf(key);
+            size_t pos = 0;
+            while (pos < count && held[pos] < stripe) ++pos;
+            if (pos < count && held[pos] == stripe) continue;
+            for (size_t i = count; i > pos; --i) {
+                held[i] = held[i - 1];
+                keyOf[i] = keyOf[i - 1];
+            }
+            held[pos] = stripe;
+            keyOf[pos] = key;
+            ++count;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            mutex& stripe = locks.stripe(held[i]);
+            sampled[i] = false;
+            if (stripe.try_lock()) {
+                if (Instrumentation::lockProfiling) {
+                    StripedLocks::StripeStats& stats = locks.statsOf(held[i]);
+                    sampled[i] = ++stats.acquisitions % StripedLocks::holdSampleEvery == 0;
+                    if (sampled[i])
+                        acquiredAt[i] = chrono::steady_clock::now();
+                }
+                continue;
+            }
+            if (!Instrumentation::counters && !Instrumentation::lockProfiling) {
+                stripe.lock();
+                continue;
+            }
+            // Only contended acquisitions pay for the clock reads
+            auto begin = chrono::steady_clock::now();
+            stripe.lock();
+            acquiredAt[i] = chrono::steady_clock::now();
+            uint64_t waited = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(acquiredAt[i] - begin).count());
+            if (Instrumentation::lockProfiling) {
+                sampled[i] = true;
+                StripedLocks::StripeStats& stats = locks.statsOf(held[i]);
+                ++stats.acquisitions;
+                ++stats.contended;
+                stats.waitNanos += waited;
+                locks.recordContention(keyOf[i], waited);
+            }
+            Metrics::count(Metrics::LockWaits);
+            Metrics::observe(Metrics::LockWaitNanos, waited);
+        }
+    }
+
+    ~StripeGuard() {
+        bool anySampled = false;
+        for (size_t i = 0; i < count; ++i) anySampled |= sampled[i];
+        auto now = anySampled ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+        for (size_t i = count; i > 0; --i) {
+            if (sampled[i - 1]) {
+                StripedLocks::StripeStats& stats = locks.statsOf(held[i - 1]);
+                ++stats.holdSamples;
+                stats.holdNanos += static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(now - acquiredAt[i - 1]).count());
+            }
+            locks.stripe(held[i - 1]).unlock();
+        }
+    }
+
+    StripeGuard(const StripeGuard&) = delete;
+    StripeGuard& operator=(const StripeGuard&) = delete;
+};
+
+/**
+ * Latency percentiles over a set of per-transaction samples in nanoseconds.
+ */
+struct LatencySummary {
+    double p50 = 0, p95 = 0, p99 = 0, max = 0;
+
+    static LatencySummary from(vector<uint64_t>& samples) {
+        LatencySummary summary;
+        if (samples.empty())
+            return summary;
+        sort(samples.begin(), samples.end());
+        auto at = [&](double q) { return samples[min(samples.size() - 1, static_cast<size_t>(q * samples.size()))] / 1e3; };
+        summary.p50 = at(0.50);
+        summary.p95 = at(0.95);
+        summary.p99 = at(0.99);
+        summary.max = samples.back() / 1e3;
+        return summary;
+    }
+};
+
+/**
+ * TPC-B style debit/credit driver over the BankAccount hierarchy.
+ * Scale follows TPC-B: one branch and ten tellers per 100,000 accounts. Branches and
+ * tellers are CheckingAccounts without a practical overdraft limit; customer accounts
+ * alternate between SavingsAccount and CheckingAccount. Each transaction picks a
+ * teller, takes an account from the teller's branch 85% of the time, applies the same
+ * signed delta to account, teller and branch, and appends a history row. Declined
+ * account withdrawals are counted and leave teller and branch untouched.
+ */
+class TpcbDriver {
+public:
+    struct Result {
+        size_t committed = 0;
+        size_t declined = 0;
+        double seconds = 0;
+        LatencySummary latency;
+    };
+
+private:
+    struct HistoryRow {
+        uint32_t account, teller, branch;
+        double delta;
+        int64_t time;
+    };
+
+    size_t branchCount;
+    size_t tellerCount;
+    size_t accountsPerBranch;
+    vector<unique_ptr<BankAccount>> branches;
+    vector<unique_ptr<BankAccount>> tellers;
+    vector<unique_ptr<BankAccount>> accounts;
+    StripedLocks locks;
+
+    static void applyDelta(BankAccount& account, double delta) {
+        if (delta >= 0) account.deposit(delta);
+        else account.withdraw(-delta);
+    }
+
+public:
+    explicit TpcbDriver(size_t accountCount)
+        : branchCount(max<size_t>(1, accountCount / 100000)),
+        tellerCount(branchCount * 10),
+        accountsPerBranch(max<size_t>(1, accountCount / branchCount)) {
+        const double unlimited = 1e15;
+        for (size_t b = 0; b < branchCount; ++b)
+            branches.push_back(make_unique<CheckingAccount>("Branch" + to_string(b), 0, unlimited));
+        for (size_t t = 0; t < tellerCount; ++t)
+            tellers.push_back(make_unique<CheckingAccount>("Teller" + to_string(t), 0, unlimited));
+        for (size_t a = 0; a < branchCount * accountsPerBranch; ++a) {
+            if (a % 2) accounts.push_back(make_unique<CheckingAccount>("Account" + to_string(a), 1000, 500));
+            else accounts.push_back(make_unique<SavingsAccount>("Account" + to_string(a), 1000, 2.5));
+        }
+    }
+
+    size_t accountCount() const { return accounts.size(); }
+
+    // Contention summary with lock keys translated back to branches, tellers and accounts
+    void printContention(ostream& out, size_t top) {
+        locks.printReport(out, top, [this](uint64_t key) {
+            if (key < branchCount) return "branch " + to_string(key);
+            if (key < branchCount + tellerCount) return "teller " + to_string(key - branchCount);
+            return "account " + to_string(key - branchCount - tellerCount);
+        });
+    }
+
+    Result run(size_t threads, size_t transactions) {
+        if (threads == 0)
+            throw invalid_argument("TPC-B needs at least one thread");
+        vector<vector<uint64_t>> latencies(threads);
+        vector<vector<HistoryRow>> history(threads);
+        vector<size_t> declined(threads, 0);
+        // Keys give branches, tellers and accounts disjoint lock namespaces
+        const uint64_t tellerBase = branchCount;
+        const uint64_t accountBase = branchCount + tellerCount;
+
+        auto start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (size_t w = 0; w < threads; ++w) {
+            workers.emplace_back([&, w]() {
+                SamplingProfiler::ThreadClass name("posting");
+                mt19937_64 rng(1234 + w);
+                uniform_int_distribution<size_t> pickTeller(0, tellerCount - 1);
+                uniform_int_distribution<size_t> pickLocal(0, accountsPerBranch - 1);
+                uniform_int_distribution<size_t> pickAny(0, accounts.size() - 1);
+                uniform_int_distribution<int> pickPercent(0, 99);
+                uniform_int_distribution<int> pickCents(-99999, 99999);
+                size_t share = transactions / threads + (w < transactions % threads ? 1 : 0);
+                latencies[w].reserve(share);
+                history[w].reserve(share);
+
+                for (size_t i = 0; i < share; ++i) {
+                    size_t teller = pickTeller(rng);
+                    size_t branch = teller / 10;
+                    size_t account = pickPercent(rng) < 85 || branchCount == 1
+                        ? branch * accountsPerBranch + pickLocal(rng) : pickAny(rng);
+                    double delta = pickCents(rng) / 100.0;
+
+                    auto begin = chrono::steady_clock::now();
+                    {
+                        StripeGuard guard(locks, { account + accountBase, teller + tellerBase, branch });
+                        try {
+                            applyDelta(*accounts[account], delta);
+                            applyDelta(*tellers[teller], delta);
+                            applyDelta(*branches[branch], delta);
+                            history[w].push_back({ static_cast<uint32_t>(account), static_cast<uint32_t>(teller),
+                                static_cast<uint32_t>(branch), delta, static_cast<int64_t>(time(nullptr)) });
+                        }
+                        catch (const runtime_error&) {
+                            ++declined[w];
+                        }
+                    }
+                    latencies[w].push_back(static_cast<uint64_t>(
+                        chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count()));
+                }
+            });
+        }
+        for (auto& worker : workers) worker.join();
+
+        Result result;
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        vector<uint64_t> all;
+        for (size_t w = 0; w < threads; ++w) {
+            all.insert(all.end(), latencies[w].begin(), latencies[w].end());
+            result.committed += history[w].size();
+            result.declined += declined[w];
+        }
+        result.latency = LatencySummary::from(all);
+        return result;
+    }
+};
+
+/**
+ * SmallBank OLTP workload over paired SavingsAccount/CheckingAccount customers.
+ * Transaction mix follows the benchmark: Amalgamate, Balance, DepositChecking,
+ * TransactSavings and WriteCheck at 15% each, SendPayment at 25%. A configurable
+ * share of picks lands on a small hotspot of customers to model skew.
+ * Declines are business-rule rejections (insufficient funds, overdraft limit);
+ * aborts are transactions that cannot run, such as paying oneself.
+ */
+class SmallBankDriver {
+public:
+    enum TxnType { Amalgamate, Balance, DepositChecking, SendPayment, TransactSavings, WriteCheck, TxnTypeCount };
+
+    struct Config {
+        size_t customers = 100000;
+        size_t threads = 1;
+        size_t transactions = 1000000;
+        size_t hotspotSize = 100;
+        double hotspotProbability = 0.9;
+    };
+
+    struct TypeStats {
+        size_t attempted = 0;
+        size_t declined = 0;
+        size_t aborted = 0;
+    };
+
+    struct Result {
+        TypeStats types[TxnTypeCount];
+        double seconds = 0;
+        LatencySummary latency;
+    };
+
+    static const char* typeName(int type) {
+        static const char* const names[] = { "Amalgamate", "Balance", "DepositChecking", "SendPayment", "TransactSavings", "WriteCheck" };
+        return names[type];
+    }
+
+private:
+    Config config;
+    vector<SavingsAccount> savings;
+    vector<CheckingAccount> checking;
+    StripedLocks locks;
+
+    static TxnType pickType(int percent) {
+        if (percent < 15) return Amalgamate;
+        if (percent < 30) return Balance;
+        if (percent < 45) return DepositChecking;
+        if (percent < 70) return SendPayment;
+        if (percent < 85) return TransactSavings;
+        return WriteCheck;
+    }
+
+    // Returns false when the transaction aborts; business-rule declines throw
+    bool execute(TxnType type, size_t first, size_t second, double amount) {
+        switch (type) {
+        case Amalgamate: {
+            if (first == second) return false;
+            StripeGuard guard(locks, { first, second });
+            double fromSavings = max(0.0, savings[first].getBalance());
+            double fromChecking = max(0.0, checking[first].getBalance());
+            if (fromSavings > 0) savings[first].withdraw(fromSavings);
+            if (fromChecking > 0) checking[first].withdraw(fromChecking);
+            checking[second].deposit(fromSavings + fromChecking);
+            return true;
+        }
+        case Balance: {
+            StripeGuard guard(locks, { first });
+            volatile double total = savings[first].getBalance() + checking[first].getBalance();
+            (void)total;
+            return true;
+        }
+        case DepositChecking: {
+            StripeGuard guard(locks, { first });
+            checking[first].deposit(amount);
+            return true;
+        }
+        case SendPayment: {
+            if (first == second) return false;
+            StripeGuard guard(locks, { first, second });
+            checking[first].withdraw(amount);
+            checking[second].deposit(amount);
+            return true;
+        }
+        case TransactSavings: {
+            StripeGuard guard(locks, { first });
+            if (amount >= 0) savings[first].deposit(amount);
+            else savings[first].withdraw(-amount);
+            return true;
+        }
+        case WriteCheck: {
+            StripeGuard guard(locks, { first });
+            double total = savings[first].getBalance() + checking[first].getBalance();
+            // Overdrawing the combined balance costs a $1 penalty
+            checking[first].withdraw(total < amount ? amount + 1 : amount);
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+public:
+    void printContention(ostream& out, size_t top) {
+        locks.printReport(out, top, [](uint64_t key) { return "customer " + to_string(key); });
+    }
+
+    explicit SmallBankDriver(const Config& cfg) : config(cfg) {
+        if (config.threads == 0 || config.customers == 0 || config.hotspotSize == 0)
+            throw invalid_argument("SmallBank needs at least one thread, customer and hot customer");
+        savings.reserve(config.customers);
+        checking.reserve(config.customers);
+        for (size_t c = 0; c < config.customers; ++c) {
+            savings.emplace_back("Customer" + to_string(c), 10000, 2.5);
+            checking.emplace_back("Customer" + to_string(c), 10000, 500);
+        }
+    }
+
+    Result run() {
+        size_t threads = config.threads;
+        vector<Result> partial(threads);
+        vector<vector<uint64_t>> latencies(threads);
+
+        auto start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (size_t w = 0; w < threads; ++w) {
+            workers.emplace_back([&, w]() {
+                SamplingProfiler::ThreadClass name("posting");
+                mt19937_64 rng(4321 + w);
+                uniform_int_distribution<size_t> pickAny(0, config.customers - 1);
+                uniform_int_distribution<size_t> pickHot(0, min(config.hotspotSize, config.customers) - 1);
+                uniform_real_distribution<double> pickUnit(0.0, 1.0);
+                uniform_int_distribution<int> pickPercent(0, 99);
+                uniform_int_distribution<int> pickAmount(1, 50000);
+                auto pickCustomer = [&]() {
+                    return pickUnit(rng) < config.hotspotProbability ? pickHot(rng) : pickAny(rng);
+                };
+                size_t share = config.transactions / threads + (w < config.transactions % threads ? 1 : 0);
+                latencies[w].reserve(share);
+
+                for (size_t i = 0; i < share; ++i) {
+                    TxnType type = pickType(pickPercent(rng));
+                    size_t first = pickCustomer();
+                    size_t second = pickCustomer();
+                    double amount = pickAmount(rng) / 100.0;
+                    if (type == TransactSavings && pickPercent(rng) < 50)
+                        amount = -amount;
+
+                    TypeStats& stats = partial[w].types[type];
+                    ++stats.attempted;
+                    auto begin = chrono::steady_clock::now();
+                    try {
+                        if (!execute(type, first, second, amount))
+                            ++stats.aborted;
+                    }
+                    catch (const runtime_error&) {
+                        ++stats.declined;
+                    }
+                    latencies[w].push_back(static_cast<uint64_t>(
+                        chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count()));
+                }
+            });
+        }
+        for (auto& worker : workers) worker.join();
+
+        Result result;
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        vector<uint64_t> all;
+        for (size_t w = 0; w < threads; ++w) {
+            for (int t = 0; t < TxnTypeCount; ++t) {
+                result.types[t].attempted += partial[w].types[t].attempted;
+                result.types[t].declined += partial[w].types[t].declined;
+                result.types[t].aborted += partial[w].types[t].aborted;
+            }
+            all.insert(all.end(), latencies[w].begin(), latencies[w].end());
+        }
+        result.latency = LatencySummary::from(all);
+        return result;
+    }
+};
+
+/**
+ * Zipfian account popularity using the Gray et al. method (as in YCSB).
+ * Precomputing zeta(n) is O(n) once per generator. When scrambled, ranks are
+ * hashed across the id space so the popular accounts are not simply the lowest ids.
+ */
+class ZipfianGenerator {
+private:
+    uint64_t items;
+    double theta, zetan, alpha, eta, halfPowTheta;
+    bool scrambled;
+
+public:
+    ZipfianGenerator(uint64_t count, double skew = 0.99, bool scramble = true)
+        : items(max<uint64_t>(1, count)), theta(skew), scrambled(scramble) {
+        if (theta <= 0.0 || theta >= 1.0)
+            throw invalid_argument("Zipfian skew must be between 0 and 1");
+        zetan = 0;
+        for (uint64_t i = 1; i <= items; ++i)
+            zetan += 1.0 / pow(static_cast<double>(i), theta);
+        double zeta2 = 1.0 + pow(0.5, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - pow(2.0 / items, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+        halfPowTheta = pow(0.5, theta);
+    }
+
+    template <typename Rng>
+    uint64_t next(Rng& rng) {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetan;
+        uint64_t rank;
+        if (uz < 1.0) rank = 0;
+        else if (uz < 1.0 + halfPowTheta) rank = 1;
+        else rank = min(items - 1, static_cast<uint64_t>(items * pow(eta * u - eta + 1.0, alpha)));
+        if (!scrambled)
+            return rank;
+        // FNV-1a over the rank bytes
+        uint64_t hash = 14695981039346656037ull;
+        for (int b = 0; b < 8; ++b) {
+            hash ^= (rank >> (b * 8)) & 0xFF;
+            hash *= 1099511628211ull;
+        }
+        return hash % items;
+    }
+};
+
+/**
+ * Operations a trace can carry; they mirror the interactive menu choices.
+ */
+enum class TraceOp : uint8_t { Deposit, Withdraw, Show, History, Interest };
+
+struct TraceRecord {
+    uint64_t offsetNs;   // time since the start of the trace
+    uint32_t account;    // account id, or index into the trace's owner names
+    TraceOp op;
+    double amount;
+};
+
+/**
+ * An operation stream plus an optional owner-name table.
+ * Captured sessions refer to accounts by owner name; generated traces use ids directly.
+ *
+ * File layout (little-endian): "BTRC", uint32 version, uint32 name count, then each
+ * name as uint32 length + bytes, uint64 record count, then each record as
+ * uint64 offsetNs, uint32 account, uint8 op, 3 bytes padding, double amount.
+ */
+struct Trace {
+    static constexpr uint32_t version = 1;
+    vector<string> owners;
+    vector<TraceRecord> records;
+
+    void save(const string& path) const {
+        ofstream out(path, ios::binary);
+        if (!out)
+            throw runtime_error("Cannot write trace file " + path);
+        auto put = [&](const void* data, size_t size) { out.write(static_cast<const char*>(data), static_cast<streamsize>(size)); };
+        uint32_t fileVersion = version;
+        uint32_t nameCount = static_cast<uint32_t>(owners.size());
+        uint64_t recordCount = records.size();
+        const char padding[3] = { 0, 0, 0 };
+        put("BTRC", 4);
+        put(&fileVersion, 4);
+        put(&nameCount, 4);
+        for (const auto& owner : owners) {
+            uint32_t length = static_cast<uint32_t>(owner.size());
+            put(&length, 4);
+            put(owner.data(), length);
+        }
+        put(&recordCount, 8);
+        for (const auto& record : records) {
+            put(&record.offsetNs, 8);
+            put(&record.account, 4);
+            put(&record.op, 1);
+            put(padding, 3);
+            put(&record.amount, 8);
+        }
+    }
+
+    static constexpr size_t recordBytes = 24;
+
+    // Counts and lengths are checked against the bytes left before anything is allocated
+    static Trace load(const string& path) {
+        ifstream in(path, ios::binary);
+        if (!in)
+            throw runtime_error("Cannot read trace file " + path);
+        in.seekg(0, ios::end);
+        uint64_t remaining = static_cast<uint64_t>(max<streamoff>(0, in.tellg()));
+        in.seekg(0, ios::beg);
+        auto get = [&](void* data, size_t size) {
+            if (size > remaining || !in.read(static_cast<char*>(data), static_cast<streamsize>(size)))
+                throw runtime_error("Truncated trace file " + path);
+            remaining -= size;
+        };
+        char magic[4];
+        uint32_t fileVersion, nameCount;
+        uint64_t recordCount;
+        get(magic, 4);
+        get(&fileVersion, 4);
+        if (string(magic, 4) != "BTRC" || fileVersion != version)
+            throw runtime_error("Unsupported trace file " + path);
+        Trace trace;
+        get(&nameCount, 4);
+        if (nameCount > remaining / 4)
+            throw runtime_error("Invalid name count in trace file " + path);
+        trace.owners.reserve(nameCount);
+        for (uint32_t i = 0; i < nameCount; ++i) {
+            uint32_t length;
+            get(&length, 4);
+            if (length > remaining)
+                throw runtime_error("Invalid name length in trace file " + path);
+            string owner(length, '\0');
+            if (length) get(&owner[0], length);
+            trace.owners.push_back(owner);
+        }
+        get(&recordCount, 8);
+        if (recordCount > remaining / recordBytes)
+            throw runtime_error("Invalid record count in trace file " + path);
+        trace.records.resize(static_cast<size_t>(recordCount));
+        char padding[3];
+        for (auto& record : trace.records) {
+            get(&record.offsetNs, 8);
+            get(&record.account, 4);
+            get(&record.op, 1);
+            get(padding, 3);
+            get(&record.amount, 8);
+            if (static_cast<uint8_t>(record.op) > static_cast<uint8_t>(TraceOp::Interest))
+                throw runtime_error("Invalid operation in trace file " + path);
+        }
+        return trace;
+    }
+};
+
+constexpr uint32_t Trace::version;
+constexpr size_t Trace::recordBytes;
+
+/**
+ * Captures the operations of an interactive session, keyed by owner name.
+ */
+class TraceRecorder {
+private:
+    Trace trace;
+    unordered_map<string, uint32_t> ownerIndex;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+public:
+    void record(const string& owner, TraceOp op, double amount = 0.0) {
+        auto found = ownerIndex.find(owner);
+        if (found == ownerIndex.end()) {
+            found = ownerIndex.emplace(owner, static_cast<uint32_t>(trace.owners.size())).first;
+            trace.owners.push_back(owner);
+        }
+        uint64_t offset = static_cast<uint64_t>(
+            chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+        trace.records.push_back({ offset, found->second, op, amount });
+    }
+
+    const Trace& getTrace() const { return trace; }
+};
+
+/**
+ * Synthetic operation streams with Zipfian account popularity, a configurable
+ * operation mix, bursts and a diurnal rate cycle. Arrival times are exponential
+ * around a rate of baseRate * (1 + diurnalAmplitude * sin(2 pi t / dayLength)),
+ * multiplied by burstMultiplier while a burst is in progress.
+ */
+class WorkloadGenerator {
+public:
+    struct Config {
+        uint32_t accounts = 100000;
+        size_t operations = 1000000;
+        double zipfTheta = 0.99;
+        // Operation mix in percent: deposit, withdraw, show, history, interest
+        double mix[5] = { 45, 35, 10, 5, 5 };
+        double baseRate = 10000;          // operations per second
+        double burstProbability = 0.001;  // chance that an operation starts a burst
+        size_t burstLength = 1000;        // operations per burst
+        double burstMultiplier = 10;
+        double diurnalAmplitude = 0.5;    // 0 disables the daily cycle
+        double dayLengthSeconds = 86400;
+        uint64_t seed = 7;
+    };
+
+    static Trace generate(const Config& config) {
+        mt19937_64 rng(config.seed);
+        ZipfianGenerator popularity(config.accounts, config.zipfTheta);
+        discrete_distribution<int> pickOp(begin(config.mix), end(config.mix));
+        uniform_real_distribution<double> unit(0.0, 1.0);
+        uniform_int_distribution<int> pickCents(100, 100000);
+        const double twoPi = 6.283185307179586;
+
+        Trace trace;
+        trace.records.reserve(config.operations);
+        double now = 0;
+        size_t burstLeft = 0;
+        for (size_t i = 0; i < config.operations; ++i) {
+            if (burstLeft == 0 && unit(rng) < config.burstProbability)
+                burstLeft = config.burstLength;
+            double rate = config.baseRate * (1.0 + config.diurnalAmplitude * sin(twoPi * now / config.dayLengthSeconds));
+            if (burstLeft > 0) {
+                rate *= config.burstMultiplier;
+                --burstLeft;
+            }
+            now += -log(1.0 - unit(rng)) / max(rate, 1e-9);
+            TraceOp op = static_cast<TraceOp>(pickOp(rng));
+            double amount = op == TraceOp::Deposit || op == TraceOp::Withdraw ? pickCents(rng) / 100.0 : 0.0;
+            trace.records.push_back({ static_cast<uint64_t>(now * 1e9),
+                static_cast<uint32_t>(popularity.next(rng)), op, amount });
+        }
+        return trace;
+    }
+};
+
+/**
+ * Feeds a trace into an AccountBook as fast as possible, at a fixed rate, or with
+ * the trace's own timing. Pacing checks the clock once every 64 operations and
+ * sleeps only when ahead of schedule, so the fast path stays a tight loop.
+ */
+class TraceReplayer {
+public:
+    enum class Pace { AsFastAsPossible, FixedRate, Recorded };
+
+    struct Stats {
+        size_t operations = 0;
+        size_t declined = 0;
+        size_t unknownAccounts = 0;
+        double seconds = 0;
+        double maxLagMs = 0;
+    };
+
+    // Id-keyed traces may name at most this many accounts
+    static constexpr uint32_t maxAccounts = 1 << 22;
+
+    /**
+     * Opens accounts until every id the trace names exists, alternating savings and
+     * checking. Captured traces name owners instead and open nothing.
+     */
+    static void openTraceAccounts(const Trace& trace, AccountBook& book, int64_t now) {
+        if (!trace.owners.empty())
+            return;
+        uint32_t highest = 0;
+        for (const auto& record : trace.records)
+            highest = max(highest, record.account);
+        if (highest >= maxAccounts)
+            throw invalid_argument("Trace names account " + to_string(highest) + "; at most "
+                + to_string(maxAccounts) + " accounts can be opened");
+        for (uint32_t id = static_cast<uint32_t>(book.size()); id <= highest; ++id)
+            book.openAccount(id % 2 ? AccountKind::Checking : AccountKind::Savings, "Account" + to_string(id), 1000, id % 2 ? 500 : 2.5, now);
+    }
+
+    // rate is in operations per second and must be positive for Pace::FixedRate
+    static Stats replay(const Trace& trace, AccountBook& book, Pace pace, double rate = 0) {
+        if (pace == Pace::FixedRate && !(rate > 0))
+            throw invalid_argument("Replay rate must be positive");
+        // Captured traces name their accounts; resolve each name once up front
+        vector<uint32_t> resolve;
+        if (!trace.owners.empty()) {
+            unordered_map<string, uint32_t> byOwner;
+            for (size_t id = 0; id < book.size(); ++id)
+                byOwner.emplace(book.getOwner(static_cast<AccountBook::AccountId>(id)), static_cast<uint32_t>(id));
+            for (const auto& owner : trace.owners) {
+                auto found = byOwner.find(owner);
+                resolve.push_back(found == byOwner.end() ? TransactionLog::noCounterparty : found->second);
+            }
+        }
+
+        Stats stats;
+        auto start = chrono::steady_clock::now();
+        int64_t wallNow = static_cast<int64_t>(time(nullptr));
+        volatile double sink = 0;
+        for (size_t i = 0; i < trace.records.size(); ++i) {
+            const TraceRecord& record = trace.records[i];
+            if (pace != Pace::AsFastAsPossible && i % 64 == 0) {
+                double due = pace == Pace::FixedRate ? i / rate : record.offsetNs / 1e9;
+                double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                if (elapsed < due)
+                    this_thread::sleep_for(chrono::duration<double>(due - elapsed));
+                else
+                    stats.maxLagMs = max(stats.maxLagMs, (elapsed - due) * 1e3);
+            }
+
+            uint32_t account = resolve.empty() ? record.account
+                : record.account < resolve.size() ? resolve[record.account] : TransactionLog::noCounterparty;
+            if (account >= book.size()) {
+                ++stats.unknownAccounts;
+                continue;
+            }
+            try {
+                switch (record.op) {
+                case TraceOp::Deposit: book.deposit(account, record.amount, wallNow); break;
+                case TraceOp::Withdraw: book.withdraw(account, record.amount, wallNow); break;
+                case TraceOp::Show: sink = book.getBalance(account); break;
+                case TraceOp::History: sink = static_cast<double>(book.getHistory().size()); break;
+                case TraceOp::Interest:
+                    if (book.getKind(account) == AccountKind::Savings)
+                        book.applyInterest(account, wallNow);
+                    break;
+                }
+            }
+            catch (const runtime_error&) {
+                ++stats.declined;
+            }
+            ++stats.operations;
+        }
+        (void)sink;
+        stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return stats;
+    }
+};
+
+constexpr uint32_t TraceReplayer::maxAccounts;
+
+/**
+ * One line of a text command stream, such as "deposit Laurie 250.00" or "W Larry 20".
+ * Operations use the menu words or their single letters, in any case. The owner
+ * points into the parsed buffer, so a command is only valid while the line is.
+ */
+enum class CommandOp : uint8_t { Deposit, Withdraw, Show, History, Interest, Exit, Invalid };
+
+struct Command {
+    CommandOp op;
+    const char* owner;
+    size_t ownerLength;
+    double amount;
+};
+
+// Lower case only; CommandParser folds the operation before the lookup
+constexpr const char* commandNames[] = { "deposit", "withdraw", "show", "history", "interest", "exit",
+    "d", "w", "s", "h", "i", "e" };
+constexpr uint8_t commandCodes[] = { 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5 };
+constexpr PerfectHashTable<12, 64> commandTable(commandNames, commandCodes);
+static_assert(commandTable.valid(), "No perfect hash seed for command names");
+
+class CommandParser {
+private:
+    static const char* skipSpaces(const char* at, const char* end) {
+        while (at < end && (*at == ' ' || *at == '\t' || *at == '\r')) ++at;
+        return at;
+    }
+
+    static const char* token(const char* at, const char* end) {
+        while (at < end && *at != ' ' && *at != '\t' && *at != '\r') ++at;
+        return at;
+    }
+
+    // ASCII-folds the operation into a small buffer; anything longer than every keyword is Invalid
+    static CommandOp operation(const char* at, const char* end) {
+        char folded[8];
+        size_t length = static_cast<size_t>(end - at);
+        if (length > sizeof(folded))
+            return CommandOp::Invalid;
+        for (size_t k = 0; k < length; ++k)
+            folded[k] = at[k] >= 'A' && at[k] <= 'Z' ? static_cast<char>(at[k] - 'A' + 'a') : at[k];
+        return static_cast<CommandOp>(commandTable.find(folded, length, static_cast<uint8_t>(CommandOp::Invalid)));
+    }
+
+    // Plain decimal amounts with up to two places: "12", "12.5", "12.50"; at most 15 whole digits
+    static bool parseAmount(const char* at, const char* end, double& amount) {
+        int64_t cents = 0;
+        const char* digits = at;
+        while (at < end && *at >= '0' && *at <= '9' && at - digits < 15) cents = cents * 10 + (*at++ - '0');
+        if (at == digits) return false;
+        cents *= 100;
+        if (at < end && *at == '.') {
+            ++at;
+            int scale = 10;
+            while (at < end && *at >= '0' && *at <= '9' && scale > 0) {
+                cents += (*at++ - '0') * scale;
+                scale /= 10;
+            }
+        }
+        amount = cents / 100.0;
+        return at == end;
+    }
+
+public:
+    // Parses [begin, end) without copying; returns false for a malformed line
+    static bool parse(const char* begin, const char* end, Command& command) {
+        const char* at = skipSpaces(begin, end);
+        const char* opEnd = token(at, end);
+        command.op = operation(at, opEnd);
+        command.amount = 0;
+        command.owner = nullptr;
+        command.ownerLength = 0;
+        if (command.op == CommandOp::Invalid)
+            return false;
+        if (command.op == CommandOp::Exit)
+            return true;
+        at = skipSpaces(opEnd, end);
+        const char* ownerEnd = token(at, end);
+        if (ownerEnd == at)
+            return false;
+        command.owner = at;
+        command.ownerLength = static_cast<size_t>(ownerEnd - at);
+        at = skipSpaces(ownerEnd, end);
+        const char* amountEnd = token(at, end);
+        bool needsAmount = command.op == CommandOp::Deposit || command.op == CommandOp::Withdraw;
+        if (!needsAmount)
+            return at == end;
+        return parseAmount(at, amountEnd, command.amount) && skipSpaces(amountEnd, end) == end;
+    }
+};
+
+/**
+ * Executes a text command stream against an AccountBook through a table of
+ * handlers indexed by operation, with owners resolved through a name index.
+ */
+class CommandDispatcher {
+public:
+    struct Stats {
+        size_t executed = 0;
+        size_t declined = 0;
+        size_t unknownOwners = 0;
+        size_t malformed = 0;
+        double checksum = 0;   // sum of balances shown, so reads are not optimized away
+    };
+
+private:
+    using Handler = void (*)(AccountBook&, AccountBook::AccountId, const Command&, int64_t, Stats&);
+
+    static void deposit(AccountBook& book, AccountBook::AccountId id, const Command& command, int64_t now, Stats&) {
+        book.deposit(id, command.amount, now);
+    }
+    static void withdraw(AccountBook& book, AccountBook::AccountId id, const Command& command, int64_t now, Stats&) {
+        book.withdraw(id, command.amount, now);
+    }
+    static void show(AccountBook& book, AccountBook::AccountId id, const Command&, int64_t, Stats& stats) {
+        stats.checksum += book.getBalance(id);
+    }
+    static void history(AccountBook& book, AccountBook::AccountId, const Command&, int64_t, Stats& stats) {
+        stats.checksum += static_cast<double>(book.getHistory().size());
+    }
+    static void interest(AccountBook& book, AccountBook::AccountId id, const Command&, int64_t now, Stats&) {
+        if (book.getKind(id) == AccountKind::Savings)
+            book.applyInterest(id, now);
+    }
+
+    AccountBook& book;
+    unordered_map<string, AccountBook::AccountId> owners;
+    string lookup;
+
+public:
+    explicit CommandDispatcher(AccountBook& accounts) : book(accounts) {
+        for (size_t id = 0; id < book.size(); ++id)
+            owners.emplace(book.getOwner(static_cast<AccountBook::AccountId>(id)), static_cast<AccountBook::AccountId>(id));
+    }
+
+    // Runs every line of text until the end or an exit command
+    Stats run(const char* text, size_t length, int64_t now) {
+        static const Handler handlers[] = { deposit, withdraw, show, history, interest };
+        Stats stats;
+        const char* end = text + length;
+        for (const char* line = text; line < end;) {
+            const char* lineEnd = static_cast<const char*>(memchr(line, '\n', static_cast<size_t>(end - line)));
+            if (!lineEnd) lineEnd = end;
+            Command command;
+            if (!CommandParser::parse(line, lineEnd, command)) {
+                stats.malformed += lineEnd > line;
+            }
+            else if (command.op == CommandOp::Exit) {
+                break;
+            }
+            else {
+                lookup.assign(command.owner, command.ownerLength);
+                auto found = owners.find(lookup);
+                if (found == owners.end()) {
+                    ++stats.unknownOwners;
+                }
+                else {
+                    try {
+                        handlers[static_cast<size_t>(command.op)](book, found->second, command, now, stats);
+                        ++stats.executed;
+                    }
+                    catch (const runtime_error&) {
+                        ++stats.declined;
+                    }
+                }
+            }
+            line = lineEnd + 1;
+        }
+        return stats;
+    }
+};
+
+/**
+ * The account store behind the C interface in BankCoreApi.h. Each call takes the
+ * lock once and runs its whole batch under it; exceptions from the book are turned
+ * into status codes and never cross the boundary.
+ */
+struct BankCore {
+    mutex lock;
+    AccountBook book;
+};
+
+namespace {
+
+double fromCents(int64_t cents) { return static_cast<double>(cents) / 100.0; }
+
+int64_t toCents(double amount) { return llround(amount * 100.0); }
+
+int32_t executeOperation(AccountBook& book, const BankOperation& operation, BankResult& result, int64_t now) {
+    size_t accounts = book.size();
+    if (operation.account >= accounts)
+        return BANK_UNKNOWN_ACCOUNT;
+    if (operation.reserved != 0)
+        return BANK_INVALID_REQUEST;
+    AccountBook::AccountId id = operation.account;
+    double amount = fromCents(operation.amount_cents);
+    switch (operation.op) {
+    case BANK_OP_DEPOSIT:
+        if (operation.amount_cents <= 0) return BANK_INVALID_REQUEST;
+        result.transaction_id = book.deposit(id, amount, now, PostingChannel::Electronic);
+        break;
+    case BANK_OP_WITHDRAW:
+        if (operation.amount_cents <= 0) return BANK_INVALID_REQUEST;
+        result.transaction_id = book.withdraw(id, amount, now, PostingChannel::Electronic);
+        break;
+    case BANK_OP_TRANSFER:
+        if (operation.counterparty >= accounts) return BANK_UNKNOWN_ACCOUNT;
+        if (operation.amount_cents <= 0 || operation.counterparty == operation.account) return BANK_INVALID_REQUEST;
+        result.transaction_id = book.transfer(id, operation.counterparty, amount, now);
+        break;
+    case BANK_OP_BALANCE:
+        break;
+    case BANK_OP_INTEREST:
+        if (book.getKind(id) != AccountKind::Savings) return BANK_INVALID_REQUEST;
+        result.transaction_id = book.applyInterest(id, now);
+        break;
+    default:
+        return BANK_INVALID_REQUEST;
+    }
+    return BANK_OK;
+}
+
+}
+
+extern "C" {
+
+uint32_t bank_core_api_version(void) {
+    return BANK_CORE_API_VERSION;
+}
+
+BankCore* bank_core_create(void) {
+    return new (nothrow) BankCore();
+}
+
+void bank_core_destroy(BankCore* core) {
+    delete core;
+}
+
+int32_t bank_core_open_account(BankCore* core, int32_t kind, const char* owner,
+    int64_t balance_cents, double rate_or_limit, uint32_t* account_out) {
+    if (!core || !owner || !account_out || (kind != BANK_ACCOUNT_SAVINGS && kind != BANK_ACCOUNT_CHECKING))
+        return BANK_INVALID_REQUEST;
+    try {
+        lock_guard<mutex> guard(core->lock);
+        AccountKind accountKind = kind == BANK_ACCOUNT_SAVINGS ? AccountKind::Savings : AccountKind::Checking;
+        *account_out = core->book.openAccount(accountKind, owner, fromCents(balance_cents), rate_or_limit,
+            static_cast<int64_t>(time(nullptr)));
+        return BANK_OK;
+    }
+    catch (...) {
+        return BANK_INTERNAL_ERROR;
+    }
+}
+
+size_t bank_core_account_count(const BankCore* core) {
+    if (!core)
+        return 0;
+    lock_guard<mutex> guard(const_cast<BankCore*>(core)->lock);
+    return core->book.size();
+}
+
+size_t bank_core_execute(BankCore* core, const BankOperation* operations, BankResult* results,
+    size_t count, int64_t now) {
+    if (!core || !operations || !results)
+        return 0;
+    size_t succeeded = 0;
+    try {
+        lock_guard<mutex> guard(core->lock);
+        for (size_t i = 0; i < count; ++i) {
+            BankResult& result = results[i];
+            result.reserved = 0;
+            result.transaction_id = 0;
+            result.balance_cents = 0;
+            try {
+                result.status = executeOperation(core->book, operations[i], result, now);
+            }
+            catch (const invalid_argument&) {
+                result.status = BANK_INVALID_REQUEST;
+            }
+            catch (const runtime_error&) {
+                result.status = BANK_DECLINED;
+            }
+            catch (...) {
+                result.status = BANK_INTERNAL_ERROR;
+            }
+            if (operations[i].account < core->book.size())
+                result.balance_cents = toCents(core->book.getBalance(operations[i].account));
+            succeeded += result.status == BANK_OK;
+        }
+    }
+    catch (...) {
+        // Only the lock itself can fail here, before any result is written
+        for (size_t i = 0; i < count; ++i)
+            results[i] = BankResult{ BANK_INTERNAL_ERROR, 0, 0, 0 };
+        return 0;
+    }
+    return succeeded;
+}
+
+}
+
+/**
+ * Binary wire format for command and result messages, read in place from a
+ * receive buffer or mapped file without deserializing. A message is a 16-byte
+ * WireHeader followed by count fixed-size records. Command records are laid out
+ * as BankOperation and result records as BankResult, so a validated command
+ * message goes to bank_core_execute as is. Result records are written straight
+ * into the outgoing buffer.
+ *
+ * All fields are little-endian and naturally aligned. Buffers must be 8-byte
+ * aligned. Versioning: a reader rejects any other major version. A new minor
+ * version may only append fields to records. Readers step through records by
+ * the header's recordSize and ignore fields they don't know, so older readers
+ * keep working.
+ */
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The wire format is read in place and needs a little-endian target"
+#endif
+
+enum class WireKind : uint16_t { Commands = 1, Results = 2 };
+
+enum class WireError { None, Truncated, Misaligned, BadMagic, UnsupportedVersion, WrongKind, RecordTooSmall, BadRecord };
+
+struct WireHeader {
+    static constexpr uint32_t magicValue = 0x4B4E4142;   // "BANK" in byte order
+    static constexpr uint8_t majorVersion = 1;
+    static constexpr uint8_t minorVersion = 0;
+
+    uint32_t magic;
+    uint8_t major;
+    uint8_t minor;
+    uint16_t kind;
+    uint16_t recordSize;
+    uint16_t reserved;
+    uint32_t count;
+
+    // Total message length in bytes; 64-bit so a hostile count cannot wrap
+    uint64_t length() const { return sizeof(WireHeader) + static_cast<uint64_t>(count) * recordSize; }
+};
+
+constexpr uint32_t WireHeader::magicValue;
+constexpr uint8_t WireHeader::majorVersion;
+constexpr uint8_t WireHeader::minorVersion;
+
+static_assert(sizeof(WireHeader) == 16 && alignof(WireHeader) == 4, "WireHeader layout changed");
+static_assert(offsetof(WireHeader, major) == 4 && offsetof(WireHeader, kind) == 6
+    && offsetof(WireHeader, recordSize) == 8 && offsetof(WireHeader, count) == 12, "WireHeader field offsets changed");
+static_assert(sizeof(BankOperation) == 24 && alignof(BankOperation) == 8 && offsetof(BankOperation, account) == 4
+    && offsetof(BankOperation, counterparty) == 8 && offsetof(BankOperation, amount_cents) == 16, "Command record layout changed");
+static_assert(sizeof(BankResult) == 24 && alignof(BankResult) == 8 && offsetof(BankResult, transaction_id) == 8
+    && offsetof(BankResult, balance_cents) == 16, "Result record layout changed");
+static_assert(is_standard_layout<BankOperation>::value && is_trivially_copyable<BankOperation>::value
+    && is_standard_layout<BankResult>::value && is_trivially_copyable<BankResult>::value, "Wire records must be plain data");
+static_assert(sizeof(WireHeader) % alignof(BankOperation) == 0, "Records after the header must stay aligned");
+
+const char* wireErrorName(WireError error) {
+    static const char* const names[] = { "none", "truncated", "misaligned", "bad magic", "unsupported version",
+        "wrong message kind", "record too small", "bad record" };
+    return names[static_cast<size_t>(error)];
+}
+
+template <typename Record> struct WireRecord;
+
+template <> struct WireRecord<BankOperation> {
+    static WireKind kind() { return WireKind::Commands; }
+    static bool valid(const BankOperation& operation) {
+        return operation.op <= BANK_OP_INTEREST && operation.reserved == 0;
+    }
+};
+
+template <> struct WireRecord<BankResult> {
+    static WireKind kind() { return WireKind::Results; }
+    static bool valid(const BankResult& result) {
+        return result.status >= BANK_OK && result.status <= BANK_INTERNAL_ERROR;
+    }
+};
+
+/**
+ * Read-only view of one message in a buffer. open() checks the header and every
+ * record, so indexing a view it accepted never reads outside the message.
+ */
+template <typename Record>
+class WireView {
+private:
+    const unsigned char* records = nullptr;
+    size_t stride = sizeof(Record);
+    size_t count = 0;
+    size_t bytes = 0;
+
+public:
+    static WireError open(const void* data, size_t size, WireView& view) {
+        if (reinterpret_cast<uintptr_t>(data) % alignof(Record) != 0)
+            return WireError::Misaligned;
+        if (size < sizeof(WireHeader))
+            return WireError::Truncated;
+        const WireHeader& header = *static_cast<const WireHeader*>(data);
+        if (header.magic != WireHeader::magicValue)
+            return WireError::BadMagic;
+        if (header.major != WireHeader::majorVersion)
+            return WireError::UnsupportedVersion;
+        if (header.kind != static_cast<uint16_t>(WireRecord<Record>::kind()))
+            return WireError::WrongKind;
+        if (header.recordSize < sizeof(Record) || header.recordSize % alignof(Record) != 0)
+            return WireError::RecordTooSmall;
+        if (header.length() > size)
+            return WireError::Truncated;
+        view.records = static_cast<const unsigned char*>(data) + sizeof(WireHeader);
+        view.stride = header.recordSize;
+        view.count = header.count;
+        view.bytes = static_cast<size_t>(header.length());
+        for (size_t i = 0; i < view.count; ++i) {
+            if (!WireRecord<Record>::valid(view[i]))
+                return WireError::BadRecord;
+        }
+        return WireError::None;
+    }
+
+    size_t size() const { return count; }
+
+    // Bytes this message occupies, for stepping to the next message in a stream
+    size_t length() const { return bytes; }
+
+    const Record& operator[](size_t i) const { return *reinterpret_cast<const Record*>(records + i * stride); }
+
+    // True when records can be handed on as a plain array (same minor version layout)
+    bool contiguous() const { return stride == sizeof(Record); }
+    const Record* data() const { return reinterpret_cast<const Record*>(records); }
+};
+
+/**
+ * Builds messages in 8-byte aligned storage. begin() writes the header and returns
+ * the record area for the caller to fill in place.
+ */
+class WireWriter {
+public:
+    template <typename Record>
+    static Record* begin(vector<uint64_t>& buffer, size_t count) {
+        if (count > UINT32_MAX)
+            throw invalid_argument("Too many records for one wire message");
+        size_t bytes = sizeof(WireHeader) + count * sizeof(Record);
+        buffer.assign((bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+        WireHeader& header = *reinterpret_cast<WireHeader*>(buffer.data());
+        header.magic = WireHeader::magicValue;
+        header.major = WireHeader::majorVersion;
+        header.minor = WireHeader::minorVersion;
+        header.kind = static_cast<uint16_t>(WireRecord<Record>::kind());
+        header.recordSize = static_cast<uint16_t>(sizeof(Record));
+        header.count = static_cast<uint32_t>(count);
+        return reinterpret_cast<Record*>(reinterpret_cast<unsigned char*>(buffer.data()) + sizeof(WireHeader));
+    }
+
+    template <typename Record>
+    static size_t encode(const Record* records, size_t count, vector<uint64_t>& buffer) {
+        Record* out = begin<Record>(buffer, count);
+        copy(records, records + count, out);
+        return sizeof(WireHeader) + count * sizeof(Record);
+    }
+};
+
+/**
+ * Executes one command message and writes the result message. Records from a newer
+ * minor version are copied down to the known layout; current ones are used in place.
+ */
+WireError executeWireMessage(BankCore* core, const void* request, size_t size,
+    vector<uint64_t>& response, vector<BankOperation>& scratch, int64_t now) {
+    WireView<BankOperation> commands;
+    WireError error = WireView<BankOperation>::open(request, size, commands);
+    if (error != WireError::None)
+        return error;
+    BankResult* results = WireWriter::begin<BankResult>(response, commands.size());
+    const BankOperation* operations = commands.data();
+    if (!commands.contiguous()) {
+        scratch.resize(commands.size());
+        for (size_t i = 0; i < commands.size(); ++i)
+            scratch[i] = commands[i];
+        operations = scratch.data();
+    }
+    bank_core_execute(core, operations, results, commands.size(), now);
+    return WireError::None;
+}
+
+/**
+ * Interface for interacting with customer accounts using advanced polymorphism.
+ * When a recorder is given, every chosen operation is captured for later replay.
+ */
+void performBankingOperations(CustomerList& customers, TraceRecorder* recorder = nullptr) {
+    string name;
+    char choice;
+    double amount;
+
+    while (true) {
+        cout << "\nEnter account owner name (or 'dormant' to list inactive accounts, 'exit' to quit): ";
+        cin >> name;
+        if (name == "exit") break;
+        if (name == "dormant") {
+            int months;
+            cout << "Months without activity: ";
+            cin >> months;
+            time_t cutoff = static_cast<time_t>(AccountBook::dormancyCutoff(static_cast<int64_t>(time(nullptr)), months));
+            auto dormant = customers.findDormant(cutoff);
+            for (auto* account : dormant)
+                cout << account->getOwner() << "\n";
+            cout << dormant.size() << " dormant account(s).\n";
+            continue;
+        }
+
+        auto* account = customers.getCustomerByName(name);
+        if (!account) {
+            cout << "Account not found.\n";
+            continue;
+        }
+
+        cout << "\nChoose operation: \nD - Deposit\nW - Withdraw\nS - Show Account\nH - Show Transaction History\nI - Apply Interest\nE - Exit\nChoice: ";
+        cin >> choice;
+
+        switch (choice) {
+        case 'D': case 'd':
+            cout << "Enter deposit amount: ";
+            cin >> amount;
+            if (recorder) recorder->record(name, TraceOp::Deposit, amount);
+            account->deposit(amount);
+            cout << "Deposit successful.\n";
+            break;
+
+        case 'W': case 'w':
+            cout << "Enter withdrawal amount: ";
+            cin >> amount;
+            if (recorder) recorder->record(name, TraceOp::Withdraw, amount);
+            try {
+                account->withdraw(amount);
+                cout << "Withdrawal successful.\n";
+            }
+            catch (const exception& e) {
+                cout << "Error: " << e.what() << endl;
+            }
+            break;
+
+        case 'S': case 's':
+            if (recorder) recorder->record(name, TraceOp::Show);
+            account->display();
+            break;
+
+        case 'H': case 'h': {
+            if (recorder) recorder->record(name, TraceOp::History);
+            auto displayTransactions = [](const BankAccount& acc) {
+                acc.displayTransactionHistory();
+                };
+            displayTransactions(*account);
+            break;
+        }
+
+        case 'I': case 'i': {
+            if (recorder) recorder->record(name, TraceOp::Interest);
+            if (auto* ib = dynamic_cast<InterestBearing*>(account)) {
+                ib->applyInterest();
+                cout << "Interest applied.\n";
+            }
+            else {
+                cout << "This account does not support interest calculation.\n";
+            }
+            break;
+        }
+
+        case 'E': case 'e':
+            return;
+
+        default:
+            cout << "Invalid choice.\n";
+        }
+    }
+}
+
+/**
+ * User-space hardware event counters for the calling thread and the threads it
+ * starts while counting, through Linux perf_event_open. Each event is opened on
+ * its own, so a machine or VM that lacks one event still reports the others; where
+ * perf is unavailable (other platforms, containers, perf_event_paranoid > 2) no
+ * event opens and available() is false. Counts are scaled when the kernel had to
+ * multiplex the events.
+ */
+class HardwareCounters {
+public:
+    enum Event { Cycles, Instructions, LlcMisses, BranchMisses, DtlbMisses, EventCount };
+
+    struct Sample {
+        bool valid[EventCount] = {};
+        double counts[EventCount] = {};
+    };
+
+    static const char* eventName(int event) {
+        static const char* const names[] = { "cycles", "instructions", "LLC-misses", "branch-misses", "dTLB-misses" };
+        return names[event];
+    }
+
+private:
+    int fds[EventCount];
+
+#if defined(__linux__)
+    static int open(uint32_t type, uint64_t config) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif
+
+public:
+    HardwareCounters() {
+        for (int& fd : fds) fd = -1;
+#if defined(__linux__)
+        fds[Cycles] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        fds[Instructions] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        fds[LlcMisses] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        fds[BranchMisses] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+        fds[DtlbMisses] = open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+#endif
+    }
+
+    ~HardwareCounters() {
+#if defined(__linux__)
+        for (int fd : fds)
+            if (fd >= 0) close(fd);
+#endif
+    }
+
+    HardwareCounters(const HardwareCounters&) = delete;
+    HardwareCounters& operator=(const HardwareCounters&) = delete;
+
+    bool available() const {
+        for (int fd : fds)
+            if (fd >= 0) return true;
+        return false;
+    }
+
+    void start() {
+#if defined(__linux__)
+        for (int fd : fds) {
+            if (fd < 0) continue;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    Sample stop() {
+        Sample sample;
+#if defined(__linux__)
+        for (int e = 0; e < EventCount; ++e) {
+            if (fds[e] < 0) continue;
+            ioctl(fds[e], PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t values[3];
+            if (read(fds[e], values, sizeof(values)) != static_cast<ssize_t>(sizeof(values)) || values[2] == 0)
+                continue;
+            sample.valid[e] = true;
+            sample.counts[e] = values[0] * (static_cast<double>(values[1]) / values[2]);
+        }
+#endif
+        return sample;
+    }
+};
+
+/**
+ * Times one benchmark body and prints a fixed-width result row.
+ * With allocation tracking, the row shows heap allocations and bytes per operation
+ * made on the benchmarking thread. Where hardware counters are available, it
+ * continues with cycles, instructions per cycle and LLC, branch and dTLB misses,
+ * each per operation.
+ */
+class BenchmarkRunner {
+private:
+    static HardwareCounters& counters() {
+        static HardwareCounters instance;
+        return instance;
+    }
+
+public:
+    static bool hasHardwareCounters() { return counters().available(); }
+
+    template <typename Body>
+    static double run(const string& name, size_t operations, Body body) {
+        HardwareCounters& hardware = counters();
+        AllocationScope allocations;
+        hardware.start();
+        auto start = chrono::steady_clock::now();
+        body();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        HardwareCounters::Sample sample = hardware.stop();
+        double perOp = operations ? 1.0 / operations : 0.0;
+        cout << left << setw(34) << name << right << setw(12) << operations << " ops"
+            << setw(12) << fixed << setprecision(2) << seconds * 1e3 << " ms"
+            << setw(12) << seconds * 1e9 * perOp << " ns/op";
+        if (AllocationScope::tracking())
+            cout << setw(9) << allocations.allocations() * perOp << " alloc" << setw(9) << setprecision(0)
+                << allocations.bytes() * perOp << " B" << setprecision(2);
+        if (sample.valid[HardwareCounters::Cycles])
+            cout << setw(10) << sample.counts[HardwareCounters::Cycles] * perOp << " cyc";
+        if (sample.valid[HardwareCounters::Cycles] && sample.valid[HardwareCounters::Instructions])
+            cout << setw(7) << sample.counts[HardwareCounters::Instructions] / max(1.0, sample.counts[HardwareCounters::Cycles]) << " IPC";
+        if (sample.valid[HardwareCounters::LlcMisses])
+            cout << setw(8) << sample.counts[HardwareCounters::LlcMisses] * perOp << " LLC";
+        if (sample.valid[HardwareCounters::BranchMisses])
+            cout << setw(8) << sample.counts[HardwareCounters::BranchMisses] * perOp << " br";
+        if (sample.valid[HardwareCounters::DtlbMisses])
+            cout << setw(8) << sample.counts[HardwareCounters::DtlbMisses] * perOp << " dTLB";
+        cout << "\n";
+        return seconds;
+    }
+};
+
+/**
+ * Checks for the behavior that moves money or drives regulatory decisions. Each
+ * check throws on its first failed expectation; "test [name]" runs every check, or
+ * those whose name contains the filter, and exits non-zero if any failed.
+ */
+class SelfTests {
+public:
+    struct Case {
+        const char* name;
+        void (*check)();
+    };
+
+    static void expect(bool condition, const string& what) {
+        if (!condition)
+            throw logic_error(what);
+    }
+
+    static void expectNear(double actual, double expected, const string& what) {
+        if (fabs(actual - expected) > 1e-6) {
+            ostringstream message;
+            message << what << ": expected " << fixed << setprecision(2) << expected << ", got " << actual;
+            throw logic_error(message.str());
+        }
+    }
+
+    template <typename Exception, typename Body>
+    static void expectThrows(Body body, const string& what) {
+        try {
+            body();
+        }
+        catch (const Exception&) {
+            return;
+        }
+        throw logic_error(what + ": expected an exception");
+    }
+};
+
+void testDormancyScan() {
+    const int64_t now = 1700000000;
+    AccountBook book;
+    book.openAccount(AccountKind::Savings, "Recent", 100, 2.5, now);
+    book.openAccount(AccountKind::Checking, "Stale", 100, 500, now - 13 * AccountBook::secondsPerMonth);
+    book.openAccount(AccountKind::Checking, "Revived", 100, 500, now - 13 * AccountBook::secondsPerMonth);
+    book.deposit(2, 5, now);
+    auto dormant = book.findDormant(AccountBook::dormancyCutoff(now, 12));
+    SelfTests::expect(dormant == vector<AccountBook::AccountId>{ 1 }, "only the stale account is dormant");
+    book.setStatus(dormant, AccountStatus::Dormant);
+    SelfTests::expect(book.findDormant(AccountBook::dormancyCutoff(now, 12)).empty(), "flagged accounts are not reported twice");
+
+    CustomerList customers;
+    customers.addCustomer(AccountFactory::createAccount("savings", "Laurie", 5000, 2.5));
+    customers.addCustomer(AccountFactory::createAccount("checking", "Larry", 1000, 500));
+    time_t current = time(nullptr);
+    SelfTests::expect(customers.findDormant(current - 60).empty(), "accounts just opened are active");
+    SelfTests::expect(customers.findDormant(current + 60).size() == 2, "the scan reads every account object");
+}
+
+void testFeeCycles() {
+    const int64_t now = 1700000000;
+    AccountBook book;
+    book.openAccount(AccountKind::Checking, "Low", 50, 500, now);
+    book.openAccount(AccountKind::Checking, "High", 5000, 500, now);
+    book.openAccount(AccountKind::Savings, "Saver", 50, 2.5, now);
+    FeeEngine engine;
+    engine.addRule({ AccountKind::Checking, FeeCondition::Maintenance, 5, 0 });
+    engine.addRule({ AccountKind::Checking, FeeCondition::MinimumBalance, 10, 100 });
+    SelfTests::expect(engine.runCycle(book, 1, now) == 2, "both checking accounts are charged");
+    SelfTests::expectNear(book.getBalance(0), 35, "maintenance and minimum-balance fees stack");
+    SelfTests::expectNear(book.getBalance(1), 4995, "only maintenance above the minimum");
+    SelfTests::expectNear(book.getBalance(2), 50, "savings has no rule");
+    SelfTests::expect(engine.runCycle(book, 1, now) == 0, "rerunning a cycle charges nothing");
+    SelfTests::expectNear(book.getBalance(0), 35, "rerun leaves balances alone");
+    SelfTests::expect(engine.runCycle(book, 2, now) == 2, "the next cycle charges again");
+    SelfTests::expectThrows<invalid_argument>([&]() { book.postFees(vector<double>(2, 1.0), 3, now); },
+        "a short fee column is rejected");
+    SelfTests::expectNear(book.getBalance(0), 20, "a rejected fee column posts nothing");
+}
+
+void testTransfersAndGraph() {
+    const int64_t now = 1700000000;
+    AccountBook book;
+    for (int i = 0; i < 5; ++i)
+        book.openAccount(AccountKind::Checking, "Node" + to_string(i), 1000, 0, now);
+    book.transfer(0, 1, 100, now);
+    book.transfer(1, 2, 50, now);
+    book.transfer(2, 0, 25, now);
+    book.transfer(0, 1, 10, now);
+    SelfTests::expectNear(book.getBalance(0), 915, "outgoing legs debit the sender");
+    SelfTests::expectNear(book.getBalance(1), 1060, "incoming legs credit the receiver");
+    SelfTests::expectThrows<invalid_argument>([&]() { book.transfer(0, 99, 1, now); }, "an unknown receiver is rejected");
+    SelfTests::expectThrows<invalid_argument>([&]() { book.transfer(99, 0, 1, now); }, "an unknown sender is rejected");
+    SelfTests::expectThrows<runtime_error>([&]() { book.transfer(3, 4, 5000, now); }, "transfers obey the withdrawal rules");
+    SelfTests::expectNear(book.getBalance(0), 915, "rejected transfers leave balances alone");
+
+    TransferGraph graph;
+    graph.refresh(book);
+    SelfTests::expect(graph.vertexCount() == 5 && graph.edgeCount() == 3, "repeated pairs collapse into one edge");
+    vector<TransferGraph::AccountId> labels = graph.connectedComponents();
+    SelfTests::expect(labels[0] == 0 && labels[1] == 0 && labels[2] == 0 && labels[3] == 3 && labels[4] == 4,
+        "components are labelled by their smallest account");
+    vector<vector<TransferGraph::AccountId>> levels = graph.fanOut(0, 3);
+    SelfTests::expect(levels.size() >= 2 && levels[0] == vector<TransferGraph::AccountId>{ 1 }
+        && levels[1] == vector<TransferGraph::AccountId>{ 2 }, "fan-out reports each account at its first hop");
+    SelfTests::expect(graph.findCycles(3, 10).size() == 1, "the 0 -> 1 -> 2 -> 0 ring is found once");
+    book.transfer(3, 4, 5, now);
+    graph.refresh(book);
+    labels = graph.connectedComponents();
+    SelfTests::expect(graph.edgeCount() == 4 && labels[4] == 3, "refresh picks up only the new transfer");
+}
+
+void testCustomerRollups() {
+    const int64_t now = 1700000000;
+    AccountBook book;
+    book.openAccount(AccountKind::Checking, "A1", 100, 500, now);
+    book.openAccount(AccountKind::Checking, "A2", 200, 500, now);
+    book.openAccount(AccountKind::Savings, "B1", 1000, 2.5, now);
+    CustomerRegistry registry(book);
+    CustomerRegistry::HouseholdId home = registry.addHousehold();
+    CustomerRegistry::CustomerId alice = registry.addCustomer("Alice", home);
+    CustomerRegistry::CustomerId bob = registry.addCustomer("Bob");
+    registry.linkAccount(alice, 0);
+    registry.linkAccount(alice, 1);
+    registry.linkAccount(bob, 2);
+    SelfTests::expectNear(registry.getCustomerBalance(alice), 300, "linking rolls balances up to the customer");
+    book.withdraw(0, 400, now);
+    SelfTests::expectNear(registry.getCustomerBalance(alice), -100, "postings update the customer total");
+    SelfTests::expectNear(registry.getCustomerExposure(alice), 300, "overdrawn accounts add exposure");
+    SelfTests::expectNear(registry.getHouseholdBalance(home), -100, "and the household total");
+    registry.joinHousehold(bob, home);
+    SelfTests::expectNear(registry.getHouseholdBalance(home), 900, "joining moves the customer's totals");
+    registry.joinHousehold(alice, CustomerRegistry::none);
+    SelfTests::expectNear(registry.getHouseholdBalance(home), 1000, "leaving takes them away again");
+    SelfTests::expectThrows<invalid_argument>([&]() { registry.linkAccount(alice, 2); }, "an account has one owner");
+    SelfTests::expectThrows<invalid_argument>([&]() { registry.linkAccount(7, 0); }, "an unknown customer is rejected");
+    SelfTests::expectThrows<invalid_argument>([&]() { registry.linkAccount(bob, 70000); }, "an unknown account is rejected");
+    SelfTests::expectThrows<invalid_argument>([&]() { registry.joinHousehold(bob, 5); }, "an unknown household is rejected");
+    SelfTests::expectThrows<invalid_argument>([&]() { registry.addCustomer("Carol", 5); }, "new customers need a real household");
+    SelfTests::expect(registry.customerCount() == 2, "a rejected customer is not added");
+}
+
+void testAccountFilters() {
+    using AccountId = AccountBook::AccountId;
+    const int64_t now = 1700000000;
+    // Enough rows for two workers and a partial last batch
+    const size_t rows = 2 * (size_t(1) << 16) + AccountFilter::batchSize / 2 + 3;
+    AccountBook book;
+    vector<AccountId> dormant, closed;
+    for (size_t i = 0; i < rows; ++i) {
+        AccountKind kind = i % 3 == 0 ? AccountKind::Savings : AccountKind::Checking;
+        double balance = static_cast<double>(i % 5000) - 1000;
+        double extra = kind == AccountKind::Savings ? static_cast<double>(i % 7) * 0.5 : static_cast<double>(i % 11) * 100;
+        AccountId id = book.openAccount(kind, "", balance, extra, now - static_cast<int64_t>(i % 400) * 86400);
+        if (i % 13 == 0) dormant.push_back(id);
+        if (i % 97 == 0) closed.push_back(id);
+    }
+    book.setStatus(dormant, AccountStatus::Dormant);
+    book.setStatus(closed, AccountStatus::Closed);
+
+    struct Case { const char* expression; function<bool(AccountId)> matches; };
+    const Case cases[] = {
+        { "balance < 0", [&](AccountId id) { return book.getBalance(id) < 0; } },
+        { "kind == savings and rate >= 2", [&](AccountId id) {
+            return book.getKind(id) == AccountKind::Savings && book.interestRateColumn()[id] >= 2; } },
+        { "status != active and balance >= 3000 and overdraft > 500", [&](AccountId id) {
+            return book.getStatus(id) != AccountStatus::Active && book.getBalance(id) >= 3000 && book.overdraftLimitColumn()[id] > 500; } },
+        { "LastActivity<=1682720000 AND kind==checking", [&](AccountId id) {
+            return book.getLastActivity(id) <= 1682720000 && book.getKind(id) == AccountKind::Checking; } },
+        { "status == closed", [&](AccountId id) { return book.getStatus(id) == AccountStatus::Closed; } },
+        { "kind != 0 and lastactivity >= 1690000000", [&](AccountId id) {
+            return book.getKind(id) != AccountKind::Savings && book.getLastActivity(id) >= 1690000000; } },
+        { "balance > 1000000", [&](AccountId) { return false; } },
+    };
+    for (const auto& test : cases) {
+        vector<AccountId> expected;
+        for (AccountId id = 0; id < rows; ++id)
+            if (test.matches(id))
+                expected.push_back(id);
+        SelfTests::expect(AccountFilter(test.expression).run(book) == expected, string("filter matches a row-by-row scan: ") + test.expression);
+    }
+
+    SelfTests::expectThrows<invalid_argument>([] { AccountFilter("owner == 1"); }, "unknown columns are rejected");
+    SelfTests::expectThrows<invalid_argument>([] { AccountFilter("balance <"); }, "incomplete predicates are rejected");
+    SelfTests::expectThrows<invalid_argument>([] { AccountFilter("balance ~ 1"); }, "unknown operators are rejected");
+    SelfTests::expectThrows<invalid_argument>([] { AccountFilter("balance < 1 and"); }, "a trailing and is rejected");
+    SelfTests::expectThrows<invalid_argument>([] { AccountFilter(" "); }, "an empty expression is rejected");
+    SelfTests::expectThrows<invalid_argument>([] { AccountFilter("product == -1"); }, "negative literals do not fit unsigned columns");
+    SelfTests::expectThrows<invalid_argument>([] { AccountFilter("kind == 300"); }, "literals must fit the column width");
+    SelfTests::expectThrows<invalid_argument>([] { AccountFilter("lastactivity < 1.5"); }, "integer columns take whole numbers");
+    SelfTests::expectThrows<invalid_argument>([] { AccountFilter("balance < nan"); }, "literals must be finite");
+}
+
+void testTpcbDriver() {
+    TpcbDriver driver(1000);
+    TpcbDriver::Result result = driver.run(2, 2000);
+    SelfTests::expect(result.committed + result.declined == 2000, "every transaction commits or declines");
+    SelfTests::expectThrows<invalid_argument>([&]() { driver.run(0, 10); }, "zero threads is rejected");
+}
+
+void testSmallBankDriver() {
+    SmallBankDriver::Config config;
+    config.customers = 500;
+    config.threads = 2;
+    config.transactions = 3000;
+    SmallBankDriver driver(config);
+    SmallBankDriver::Result result = driver.run();
+    size_t attempted = 0;
+    for (const auto& stats : result.types)
+        attempted += stats.attempted;
+    SelfTests::expect(attempted == 3000, "every transaction is attempted once");
+    config.threads = 0;
+    SelfTests::expectThrows<invalid_argument>([&]() { SmallBankDriver rejected(config); }, "zero threads is rejected");
+    config.threads = 1;
+    config.hotspotSize = 0;
+    SelfTests::expectThrows<invalid_argument>([&]() { SmallBankDriver rejected(config); }, "an empty hotspot is rejected");
+}
+
+void testWorkloadTraces() {
+    const int64_t now = 1700000000;
+    mt19937_64 rng(11);
+    ZipfianGenerator ranks(1000, 0.99, false);
+    vector<size_t> hits(1000, 0);
+    for (int i = 0; i < 20000; ++i)
+        ++hits[ranks.next(rng)];
+    SelfTests::expect(hits[0] > hits[1] && hits[1] > hits[10] && hits[10] > hits[500], "popularity falls with rank");
+    SelfTests::expectThrows<invalid_argument>([]() { ZipfianGenerator(10, 1.0); }, "skew must stay below 1");
+
+    WorkloadGenerator::Config config;
+    config.accounts = 50;
+    config.operations = 2000;
+    Trace generated = WorkloadGenerator::generate(config);
+    SelfTests::expect(generated.records.size() == 2000, "the requested number of operations is generated");
+    bool ordered = true, inRange = true;
+    for (size_t i = 0; i < generated.records.size(); ++i) {
+        ordered &= i == 0 || generated.records[i].offsetNs >= generated.records[i - 1].offsetNs;
+        inRange &= generated.records[i].account < 50;
+    }
+    SelfTests::expect(ordered && inRange, "arrivals are ordered and accounts are in range");
+
+    TraceRecorder recorder;
+    recorder.record("Laurie", TraceOp::Deposit, 125.5);
+    recorder.record("Nobody", TraceOp::Show);
+    recorder.record("Laurie", TraceOp::Withdraw, 20000);
+    recorder.record("Larry", TraceOp::Withdraw, 100);
+    const string path = "selftest-trace.bin";
+    recorder.getTrace().save(path);
+    Trace loaded = Trace::load(path);
+    remove(path.c_str());
+    SelfTests::expect(loaded.owners == recorder.getTrace().owners && loaded.records.size() == 4, "a saved trace loads back");
+    SelfTests::expect(loaded.records[0].op == TraceOp::Deposit && loaded.records[0].amount == 125.5, "records round-trip exactly");
+
+    AccountBook book;
+    book.openAccount(AccountKind::Savings, "Laurie", 5000, 2.5, now);
+    book.openAccount(AccountKind::Checking, "Larry", 1000, 500, now);
+    TraceReplayer::Stats stats = TraceReplayer::replay(loaded, book, TraceReplayer::Pace::AsFastAsPossible);
+    SelfTests::expect(stats.operations == 3 && stats.unknownAccounts == 1 && stats.declined == 1, "replay resolves owners by name");
+    SelfTests::expectNear(book.getBalance(0), 5125.5, "captured deposits are replayed");
+    SelfTests::expectNear(book.getBalance(1), 900, "captured withdrawals are replayed");
+    for (double rate : { 0.0, -5.0, nan("") })
+        SelfTests::expectThrows<invalid_argument>([&]() { TraceReplayer::replay(loaded, book, TraceReplayer::Pace::FixedRate, rate); },
+            "a fixed rate must be positive");
+
+    Trace wide;
+    wide.records.push_back({ 0, 3, TraceOp::Show, 0 });
+    AccountBook opened;
+    TraceReplayer::openTraceAccounts(wide, opened, now);
+    SelfTests::expect(opened.size() == 4, "replay opens every account an id trace names");
+    wide.records.push_back({ 1, UINT32_MAX, TraceOp::Show, 0 });
+    SelfTests::expectThrows<invalid_argument>([&]() { TraceReplayer::openTraceAccounts(wide, opened, now); },
+        "an id past the account limit is refused");
+    SelfTests::expect(opened.size() == 4, "and opens nothing");
+
+    // Headers whose counts or lengths cannot fit in the file
+    auto corrupt = [&](uint32_t names, uint32_t length, uint64_t records) {
+        ofstream out(path, ios::binary);
+        uint32_t fileVersion = Trace::version;
+        out.write("BTRC", 4);
+        out.write(reinterpret_cast<const char*>(&fileVersion), 4);
+        out.write(reinterpret_cast<const char*>(&names), 4);
+        if (names > 0) {
+            out.write(reinterpret_cast<const char*>(&length), 4);
+            out.write("Laurie", 6);
+        }
+        out.write(reinterpret_cast<const char*>(&records), 8);
+        out.close();
+        bool rejected = false;
+        try { Trace::load(path); }
+        catch (const runtime_error&) { rejected = true; }
+        remove(path.c_str());
+        return rejected;
+    };
+    SelfTests::expect(corrupt(0xFFFFFFFF, 6, 0), "a name count past the file is rejected");
+    SelfTests::expect(corrupt(1, 0x7FFFFFFF, 0), "a name length past the file is rejected");
+    SelfTests::expect(corrupt(1, 6, uint64_t(1) << 60), "a record count past the file is rejected");
+    SelfTests::expect(!corrupt(1, 6, 0), "an empty trace still loads");
+}
+
+class PostingRecorder : public BookObserver {
+public:
+    struct Event {
+        uint32_t account;
+        PostingType type;
+        PostingChannel channel;
+        double amount, oldBalance, newBalance;
+    };
+    vector<Event> events;
+
+    void onPosting(uint32_t account, PostingType type, PostingChannel channel, double amount, double oldBalance,
+        double newBalance, int64_t) override {
+        events.push_back({ account, type, channel, amount, oldBalance, newBalance });
+    }
+};
+
+void testBulkPosting() {
+    const int64_t now = 1700000000;
+    AccountBook book;
+    book.openAccount(AccountKind::Checking, "Payroll", 100, 0, now);
+    book.openAccount(AccountKind::Savings, "Saver", 50, 2.5, now);
+    book.openAccount(AccountKind::Checking, "Worker", 0, 100, now);
+    PostingRecorder recorder;
+    book.addObserver(&recorder);
+    BulkPostResult result = book.postBulk({ { 2, 500 }, { 0, -30 }, { 1, -80 }, { 2, -150 }, { 9, 1 }, { 1, 20 }, { 0, 10 } }, now);
+    book.removeObserver(&recorder);
+    SelfTests::expect(result.posted == 4 && result.accounts == 2, "accepted runs post every row");
+    SelfTests::expect(result.rejected.size() == 3, "the unknown account and the declined net debit are rejected");
+    SelfTests::expectNear(book.getBalance(0), 80, "duplicates are netted");
+    SelfTests::expectNear(book.getBalance(1), 50, "a declined run leaves the balance alone");
+    SelfTests::expectNear(book.getBalance(2), 350, "credits and debits are applied together");
+    SelfTests::expect(book.getHistory().size() == 4, "one history row per accepted posting");
+    SelfTests::expect(recorder.events.size() == 4, "observers see each posting, not one net per account");
+    const PostingRecorder::Event& debit = recorder.events[3];
+    SelfTests::expect(debit.account == 2 && debit.type == PostingType::Withdrawal, "postings keep their file order");
+    SelfTests::expect(debit.channel == PostingChannel::Electronic, "bulk postings are not cash");
+    SelfTests::expectNear(debit.oldBalance, 500, "the balance steps through the run");
+    SelfTests::expectNear(debit.newBalance, 350, "and ends at the posted balance");
+}
+
+void testAchIngestion() {
+    const int64_t now = 1700000000;
+    const string path = "selftest-ach.txt";
+    auto openBook = [&](AccountBook& book) {
+        for (size_t id = 0; id < 100; ++id)
+            book.openAccount(AccountKind::Checking, "Account" + to_string(id), 1000, 500, now);
+    };
+    auto total = [](const AccountBook& book) {
+        double sum = 0;
+        for (size_t id = 0; id < book.size(); ++id)
+            sum += book.getBalance(static_cast<AccountBook::AccountId>(id));
+        return sum;
+    };
+    auto rewrite = [&](size_t offset, char digit) {
+        fstream file(path, ios::in | ios::out | ios::binary);
+        file.seekp(static_cast<streamoff>(offset));
+        file.put(digit);
+    };
+    const size_t stride = AchFileProcessor::recordLength + 1;
+
+    AchFileProcessor::writeSample(path, 3, 8, 100);
+    AccountBook book;
+    openBook(book);
+    AchFileProcessor::Report report = AchFileProcessor::process(path, book, now);
+    SelfTests::expect(report.fileControlValid && report.invalidBatches == 0, "a well-formed file validates");
+    SelfTests::expect(report.posted == 24 && report.rejected == 0, "every entry is posted");
+    SelfTests::expectNear(total(book), 100000 + (report.creditCents - report.debitCents) / 100.0, "postings match the control totals");
+
+    // First entry of the second batch: one cent more breaks that batch's totals only
+    size_t entry = (1 + 10 + 1) * stride;
+    ifstream in(path, ios::binary);
+    in.seekg(static_cast<streamoff>(entry + 38));
+    char last = static_cast<char>(in.get());
+    in.close();
+    rewrite(entry + 38, last == '9' ? '8' : static_cast<char>(last + 1));
+    AccountBook partial;
+    openBook(partial);
+    report = AchFileProcessor::process(path, partial, now);
+    SelfTests::expect(report.fileControlValid && report.invalidBatches == 1, "a bad entry fails its batch");
+    SelfTests::expect(report.posted == 16, "the other batches still post");
+
+    // Changing the file control's debit total rejects the whole file
+    AchFileProcessor::writeSample(path, 3, 8, 100);
+    size_t fileControl = (1 + 3 * 10) * stride;
+    rewrite(fileControl + 31, '9');
+    AccountBook rejected;
+    openBook(rejected);
+    report = AchFileProcessor::process(path, rejected, now);
+    SelfTests::expect(!report.fileControlValid && report.posted == 0, "bad file control totals reject the file");
+    SelfTests::expectNear(total(rejected), 100000, "a rejected file moves no money");
+    remove(path.c_str());
+}
+
+// Serves a prefix of a document, then fails the way a broken socket or disk would
+class FailingBuffer : public streambuf {
+private:
+    string text;
+    bool served = false;
+
+protected:
+    int_type underflow() override {
+        if (served)
+            throw runtime_error("read failed");
+        served = true;
+        setg(&text[0], &text[0], &text[0] + text.size());
+        return traits_type::to_int_type(text[0]);
+    }
+
+public:
+    explicit FailingBuffer(string prefix) : text(move(prefix)) {}
+};
+
+void testPain001Pipeline() {
+    const int64_t now = 1700000000;
+    AccountBook book;
+    for (size_t id = 0; id < 10; ++id)
+        book.openAccount(AccountKind::Checking, "Account" + to_string(id), 100000, 500, now);
+    stringstream sample;
+    Pain001Processor::writeSample(sample, 50, 10);
+    Pain001Processor::Report report = Pain001Processor::process(sample, book, now, "USD", 8, 2);
+    SelfTests::expect(report.transactions == 50, "every transaction is read");
+    SelfTests::expect(report.posted + report.rejected + report.declined == 50, "every transaction is accounted for");
+    SelfTests::expect(report.posted > 0 && report.rejected == 5, "self-transfers are rejected, the rest post");
+
+    // Each amount fits int64 as digits but not once scaled to cents
+    for (const char* amount : { "99999999999999999999.00", "100000000000000000", "92233720368547758.1" }) {
+        const string wide = string("<Document><CstmrCdtTrfInitn><PmtInf><DbtrAcct><Id><Othr><Id>1</Id></Othr></Id></DbtrAcct>"
+            "<CdtTrfTxInf><Amt><InstdAmt Ccy=\"USD\">") + amount + "</InstdAmt></Amt>"
+            "<CdtrAcct><Id><Othr><Id>2</Id></Othr></Id></CdtrAcct></CdtTrfTxInf></PmtInf></CstmrCdtTrfInitn></Document>";
+        istringstream overflow(wide);
+        double before = book.getBalance(1);
+        report = Pain001Processor::process(overflow, book, now);
+        SelfTests::expect(report.transactions == 1 && report.rejected == 1 && report.posted == 0,
+            string("an amount past int64 cents is rejected: ") + amount);
+        SelfTests::expectNear(book.getBalance(1), before, "and moves no money");
+    }
+
+    string prefix = sample.str().substr(0, 2000);
+    FailingBuffer buffer(prefix);
+    istream broken(&buffer);
+    broken.exceptions(ios::badbit);
+    SelfTests::expectThrows<runtime_error>([&]() { Pain001Processor::process(broken, book, now, "USD", 1, 1); },
+        "a failing reader surfaces its error after the stages stop");
+}
+
+void testProductCatalog() {
+    const int64_t now = 1700000000;
+    ProductCatalog catalog;
+    ProductCatalog::ProductId premier = catalog.addProduct("premier-savings", AccountKind::Savings, 4.0, 0);
+    ProductCatalog::ProductId basic = catalog.addProduct("basic-checking", AccountKind::Checking, 0, 50);
+    SelfTests::expect(catalog.findProduct("basic-checking") == basic, "products are found by name");
+    SelfTests::expect(catalog.findProduct("gold") == ProductCatalog::noProduct, "unknown names are reported");
+    AccountBook book;
+    book.setCatalog(&catalog);
+    book.openAccount(AccountKind::Savings, "Own", 100, 1.5, now);
+    book.openAccount(premier, "Premier", 1000, now);
+    book.openAccount(basic, "Basic", 20, now);
+    const ProductCatalog::Table* before = catalog.snapshot();
+    catalog.setInterestRate(premier, 5.0);
+    SelfTests::expect(catalog.snapshot()->version == before->version + 1, "a change publishes a new version");
+    SelfTests::expectNear(before->rows[premier].interestRate, 4.0, "an older snapshot keeps its values");
+    book.applyInterest(1, now);
+    SelfTests::expectNear(book.getBalance(1), 1050, "product accounts earn the current catalog rate");
+    SelfTests::expect(book.applyInterestBulk(now) == 2, "bulk interest credits every savings account");
+    SelfTests::expectNear(book.getBalance(0), 101.5, "accounts without a product keep their own rate");
+    SelfTests::expectThrows<runtime_error>([&]() { book.withdraw(2, 80, now); }, "the product overdraft limit applies");
+    catalog.setOverdraftLimit(basic, 100);
+    book.withdraw(2, 80, now);
+    SelfTests::expectNear(book.getBalance(2), -60, "a raised limit is seen by the next withdrawal");
+
+    AccountBook terms;
+    terms.setCatalog(&catalog);
+    terms.openAccount(AccountKind::Savings, "Own", 100, 1.5, now);
+    terms.openAccount(AccountKind::Checking, "OwnChecking", -300, 800, now);
+    terms.openAccount(premier, "Premier", 5000, now);
+    terms.openAccount(basic, "Basic", 20, now);
+    SelfTests::expect(AccountFilter("rate > 2").run(terms) == vector<AccountBook::AccountId>{ 2 }, "filter rates come from the catalog");
+    SelfTests::expect(AccountFilter("overdraft < 200 and kind == checking").run(terms) == vector<AccountBook::AccountId>{ 3 },
+        "filter overdraft limits come from the catalog");
+    SelfTests::expect(AccountFilter("balance < 0 and overdraft >= 800").run(terms) == vector<AccountBook::AccountId>{ 1 },
+        "filters read the own terms of accounts without a product");
+    catalog.setInterestRate(premier, 1.0);
+    SelfTests::expect(AccountFilter("rate > 2").run(terms).empty(), "a catalog change is seen by the next run");
+    SelfTests::expect(AccountFilter("product == 1").run(terms) == vector<AccountBook::AccountId>{ 3 }, "product ids are selectable");
+}
+
+void testReversals() {
+    const int64_t now = 1700000000;
+    AccountBook book;
+    book.openAccount(AccountKind::Checking, "From", 1000, 500, now);
+    book.openAccount(AccountKind::Savings, "To", 1000, 2.5, now);
+    uint64_t deposit = book.deposit(0, 200, now);
+    uint64_t withdrawal = book.withdraw(0, 50, now);
+    uint64_t transfer = book.transfer(0, 1, 300, now);
+    uint64_t incoming = transfer + 1;
+
+    uint64_t reversal = book.reverse(deposit, now);
+    SelfTests::expect(reversal != 0 && book.reversalOf(deposit) == reversal, "a reversal is linked to its original");
+    SelfTests::expectNear(book.getBalance(0), 650, "reversing a deposit takes it back");
+    book.reverse(withdrawal, now);
+    SelfTests::expectNear(book.getBalance(0), 700, "reversing a withdrawal returns it");
+    book.reverse(incoming, now);
+    SelfTests::expectNear(book.getBalance(0), 1000, "reversing the incoming leg restores the sender");
+    SelfTests::expectNear(book.getBalance(1), 1000, "and the receiver");
+    SelfTests::expect(book.reversalOf(transfer) != 0, "both transfer legs are marked reversed");
+
+    SelfTests::expectThrows<invalid_argument>([&]() { book.reverse(deposit, now); }, "a transaction is reversed once");
+    SelfTests::expectThrows<invalid_argument>([&]() { book.reverse(transfer, now); }, "including the other transfer leg");
+    SelfTests::expectThrows<invalid_argument>([&]() { book.reverse(reversal, now); }, "a reversal cannot be reversed");
+    SelfTests::expectThrows<invalid_argument>([&]() { book.reverse(reversal + 1000000, now); }, "unknown ids are rejected");
+
+    AccountBook::AccountId owner;
+    size_t row;
+    SelfTests::expect(book.findTransaction(withdrawal, owner, row) && owner == 0
+        && book.getHistory().typeAt(row) == PostingType::Withdrawal, "ids resolve to their history row");
+}
+
+void testCashReporting() {
+    const int64_t day = 1700006400 / 86400 * 86400;   // midnight UTC
+    AccountBook book;
+    for (int i = 0; i < 6; ++i)
+        book.openAccount(AccountKind::Checking, "Cash" + to_string(i), 0, 10000, day);
+    CustomerRegistry registry(book);
+    CustomerRegistry::CustomerId owner = registry.addCustomer("Owner");   // customer 0
+    registry.linkAccount(owner, 1);
+    vector<CashReportingMonitor::Candidate> reports;
+    CashReportingMonitor monitor(book, [&](const vector<CashReportingMonitor::Candidate>& batch) {
+        reports.insert(reports.end(), batch.begin(), batch.end());
+    }, &registry);
+
+    // Unlinked account 0 and customer 0 share an id; each stays under the thresholds on its own
+    book.deposit(0, 3000, day + 100);
+    book.deposit(0, 3000, day + 200);
+    book.deposit(1, 6000, day + 300);
+    // Electronic credits are not cash, however large
+    book.postBulk({ { 2, 20000 } }, day + 400);
+    book.deposit(2, 15000, day + 500, PostingChannel::Electronic);
+    // Account 3 crosses the threshold only with a posting that arrives after the day turned
+    book.deposit(3, 6000, day + 600);
+    book.deposit(5, 1, day + 86400 + 10);
+    book.deposit(3, 5000, day + 700);
+    SelfTests::expect(reports.empty(), "nothing is reported before the flush job");
+    monitor.endOfDay();
+    SelfTests::expect(reports.size() == 1, "only the late-completed account is reported");
+    const CashReportingMonitor::Candidate& report = reports[0];
+    SelfTests::expect(report.unlinkedAccount && report.customer == 3 && report.exceedsThreshold,
+        "it is reported as an unlinked account");
+    SelfTests::expectNear(report.cashIn, 11000, "including the late posting");
+    SelfTests::expect(report.businessDay == day / 86400, "for the day the postings belong to");
+
+    book.deposit(3, 100, day + 800);
+    SelfTests::expect(monitor.latePostings() == 1, "postings for a reported day are counted, not merged");
+
+    reports.clear();
+    book.deposit(0, 10500, day + 86400 + 20);
+    book.withdraw(1, 4500, day + 86400 + 30);
+    book.withdraw(1, 4500, day + 86400 + 40);
+    monitor.flushAll();
+    SelfTests::expect(reports.size() == 2, "the customer and the unlinked account are reported separately");
+    for (const auto& candidate : reports) {
+        if (candidate.unlinkedAccount)
+            SelfTests::expect(candidate.customer == 0 && candidate.exceedsThreshold && !candidate.structured, "account over the threshold");
+        else
+            SelfTests::expect(candidate.customer == owner && candidate.structured && !candidate.exceedsThreshold, "customer structuring withdrawals");
+    }
+}
+
+void testMetrics() {
+    const int64_t now = 1700000000;
+    uint64_t deposits = Metrics::total(Metrics::Deposits);
+    uint64_t declines = Metrics::total(Metrics::Declines);
+    AccountBook book;
+    book.openAccount(AccountKind::Checking, "Metered", 100, 0, now);
+    thread worker([&]() {
+        book.deposit(0, 10, now);
+        book.deposit(0, 10, now);
+    });
+    worker.join();
+    book.deposit(0, 10, now);
+    SelfTests::expectThrows<runtime_error>([&]() { book.withdraw(0, 1000, now); }, "the overdraft is refused");
+    uint64_t counted = Instrumentation::counters ? 3 : 0;
+    SelfTests::expect(Metrics::total(Metrics::Deposits) - deposits == counted, "a finished thread's counts are kept");
+    SelfTests::expect(Metrics::total(Metrics::Declines) - declines == counted / 3, "declines are counted");
+
+    ostringstream scrape;
+    {
+        MetricsGauge gauge("bank_selftest_depth{queue=\"a\"}", "Self-test gauge.", []() { return 7.0; });
+        Metrics::render(scrape);
+    }
+    string text = scrape.str();
+    SelfTests::expect(text.find("# TYPE bank_operations_total counter\n") != string::npos, "counters are typed");
+    SelfTests::expect(text.find("bank_operations_total{op=\"deposit\"} ") != string::npos, "counters are labelled by operation");
+    SelfTests::expect(text.find("bank_bulk_post_batch_size_bucket{le=\"+Inf\"} ") != string::npos, "histograms end with +Inf");
+    SelfTests::expect(text.find("# TYPE bank_selftest_depth gauge\nbank_selftest_depth{queue=\"a\"} 7\n") != string::npos,
+        "gauges are sampled under their family");
+    ostringstream after;
+    Metrics::render(after);
+    SelfTests::expect(after.str().find("bank_selftest_depth") == string::npos, "a scoped gauge is removed");
+
+    // Scrape the book's memory gauges while another thread grows it
+    AccountBook growing;
+    BookMetrics bookMetrics(growing);
+    atomic<bool> posting(true);
+    thread poster([&]() {
+        for (int i = 0; i < 2000; ++i) {
+            growing.openAccount(AccountKind::Checking, "Grower", 0, 0, now);
+            growing.deposit(static_cast<AccountBook::AccountId>(i), 1, now);
+        }
+        posting = false;
+    });
+    size_t scrapes = 0;
+    do {
+        ostringstream concurrent;
+        Metrics::render(concurrent);
+        ++scrapes;
+    } while (posting);
+    poster.join();
+    AccountBook::MemoryUsage published = growing.publishedMemoryUsage();
+    AccountBook::MemoryUsage actual = growing.memoryUsage();
+    if (Instrumentation::counters)
+        SelfTests::expect(published.accounts == actual.accounts && published.history == actual.history && published.index == actual.index,
+            "scrapes see the memory the posting thread last published");
+    else
+        SelfTests::expect(published.accounts == 0 && published.history == 0, "nothing is published with counters compiled out");
+    ostringstream last;
+    Metrics::render(last);
+    SelfTests::expect(scrapes > 0 && last.str().find("bank_memory_bytes{subsystem=\"history\"} " + to_string(published.history) + "\n") != string::npos,
+        "the history gauge reports the published figure");
+}
+
+void testSpanTracing() {
+    SpanTracer::clear();
+    SpanTracer::enable(4);
+    thread worker([]() {
+        for (uint64_t i = 0; i < 6; ++i)
+            SpanTracer::record("selftest.ring", 5000000 + i * 1000, 5002500 + i * 1000);
+    });
+    worker.join();
+    thread scoped([]() { ScopedSpan span("selftest.scoped"); });
+    scoped.join();
+    SpanTracer::enable();
+    SpanTracer::disable();
+    { ScopedSpan span("selftest.disabled"); }
+    ostringstream dump;
+    SpanTracer::dump(dump);
+    SpanTracer::clear();
+
+    string text = dump.str();
+    size_t kept = 0;
+    for (size_t at = text.find("selftest.ring"); at != string::npos; at = text.find("selftest.ring", at + 1))
+        ++kept;
+    SelfTests::expect(text.compare(0, 39, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[") == 0
+        && text.compare(text.size() - 4, 4, "\n]}\n") == 0, "the dump is one trace-event document");
+    SelfTests::expect(kept == 4, "a full ring keeps only the newest spans");
+    SelfTests::expect(text.find("\"ts\":5003.000,\"dur\":2.500") != string::npos, "times are microseconds with nanosecond digits");
+    SelfTests::expect(text.find("\"ts\":5001.000,") == string::npos, "the oldest spans are overwritten");
+    SelfTests::expect((text.find("selftest.scoped") != string::npos) == Instrumentation::spans, "scoped spans follow the build level");
+    SelfTests::expect(text.find("selftest.disabled") == string::npos, "nothing is recorded while tracing is off");
+}
+
+void testHardwareCounters() {
+    SelfTests::expect(string(HardwareCounters::eventName(HardwareCounters::DtlbMisses)) == "dTLB-misses", "events are named like perf");
+    HardwareCounters counters;
+    counters.start();
+    volatile uint64_t sink = 0;
+    for (uint64_t i = 0; i < 1000000; ++i)
+        sink = sink + i;
+    HardwareCounters::Sample sample = counters.stop();
+    bool anyValid = false;
+    for (int e = 0; e < HardwareCounters::EventCount; ++e) {
+        anyValid = anyValid || sample.valid[e];
+        SelfTests::expect(sample.valid[e] || sample.counts[e] == 0, "events that did not open report nothing");
+        SelfTests::expect(sample.counts[e] >= 0, "scaled counts are not negative");
+    }
+    SelfTests::expect(!anyValid || counters.available(), "samples come only from opened events");
+    if (sample.valid[HardwareCounters::Instructions])
+        SelfTests::expect(sample.counts[HardwareCounters::Instructions] >= 1000000, "the measured loop is counted");
+}
+
+void testAllocationTracking() {
+    AccountBook book;
+    AllocationScope scope;
+    for (int i = 0; i < 64; ++i)
+        book.openAccount(AccountKind::Savings, "An owner name too long for the small-string buffer", 100, 2.5, 1700000000);
+    if (!AllocationScope::tracking()) {
+        SelfTests::expect(scope.allocations() == 0 && scope.bytes() == 0, "untracked builds report nothing");
+        scope.requireNone("an untracked scope");
+        return;
+    }
+    SelfTests::expect(scope.allocations() >= 64 && scope.frees() > 0, "new and delete are counted");
+    SelfTests::expect(scope.bytes() >= 64 * 50, "requested bytes are counted");
+    SelfTests::expectThrows<logic_error>([&]() { scope.requireNone("opening accounts"); }, "allocating in a pinned scope fails");
+
+    size_t fromWorker = 0;
+    uint64_t before = scope.allocations();
+    thread worker([&]() {
+        AllocationScope inside;
+        for (int i = 0; i < 64; ++i)
+            book.openAccount(AccountKind::Savings, "An owner name too long for the small-string buffer", 100, 2.5, 1700000000);
+        fromWorker = static_cast<size_t>(inside.allocations());
+    });
+    worker.join();
+    SelfTests::expect(fromWorker >= 64, "a thread counts its own allocations");
+    SelfTests::expect(scope.allocations() - before < 8, "and not another thread's");
+}
+
+void testLockProfiling() {
+    HeavyHitters sketch(4);
+    for (uint64_t i = 0; i < 1000; ++i) {
+        sketch.add(7, 10);
+        if (i % 3 == 0) sketch.add(8);
+        sketch.add(100 + i);
+    }
+    vector<HeavyHitters::Entry> top = sketch.top(2);
+    SelfTests::expect(top.size() == 2 && top[0].key == 7, "a key above total/K is always tracked");
+    SelfTests::expect(top[0].count >= 1000 && top[0].count - top[0].error <= 1000, "counts bound the truth from both sides");
+    SelfTests::expect(top[0].weight >= 10 * (1000 - top[0].error), "weights add up for tracked keys");
+
+    StripedLocks locks(16);
+    SelfTests::expectThrows<invalid_argument>([&]() { StripeGuard guard(locks, { 1, 2, 3, 4, 5 }); }, "at most four keys");
+    { StripeGuard guard(locks, { 3, 3 + 16, 35 }); }   // one stripe, taken once
+
+    mutex step;
+    condition_variable changed;
+    bool held = false;
+    thread holder([&]() {
+        StripeGuard guard(locks, { 5 });
+        {
+            lock_guard<mutex> lock(step);
+            held = true;
+        }
+        changed.notify_all();
+        this_thread::sleep_for(chrono::milliseconds(20));
+    });
+    {
+        unique_lock<mutex> lock(step);
+        changed.wait(lock, [&]() { return held; });
+    }
+    { StripeGuard guard(locks, { 5, 2 }); }
+    holder.join();
+
+    StripedLocks::Report report = locks.report();
+    if (!Instrumentation::lockProfiling) {
+        SelfTests::expect(report.total.acquisitions == 0 && report.hottestKeys.empty(), "profiling compiled out records nothing");
+        return;
+    }
+    SelfTests::expect(report.total.acquisitions == 4 && report.total.contended == 1, "every acquisition and each wait is counted");
+    SelfTests::expect(report.total.waitNanos >= 1000000, "the wait covers the time the holder kept the stripe");
+    SelfTests::expect(report.hottestStripes.size() == 1 && report.hottestStripes[0].first == locks.stripeOf(5), "the contended stripe is reported");
+    SelfTests::expect(report.hottestKeys.size() == 1 && report.hottestKeys[0].key == 5, "only keys that waited reach the sketch");
+}
+
+void testSamplingProfiler() {
+    if (!SamplingProfiler::start(1000))
+        return;
+    uint64_t before = SamplingProfiler::sampleCount();
+    volatile double sink = 0;
+    thread worker([&]() {
+        SamplingProfiler::ThreadClass name("selftest");
+        auto until = chrono::steady_clock::now() + chrono::milliseconds(300);
+        while (chrono::steady_clock::now() < until)
+            for (int i = 0; i < 10000; ++i)
+                sink = sink + sqrt(static_cast<double>(i));
+    });
+    worker.join();
+    SamplingProfiler::stop();
+    ostringstream folded;
+    SamplingProfiler::writeFolded(folded);
+    SelfTests::expect(SamplingProfiler::sampleCount() > before, "a busy thread is sampled");
+    SelfTests::expect(folded.str().find("\nselftest;") != string::npos || folded.str().compare(0, 9, "selftest;") == 0,
+        "samples are folded under the thread's class");
+}
+
+void testPolicyAccounts() {
+    PolicyAccountStore store;
+    PolicyAccountStore::Handle saver = store.open("savings", "Saver", 1000, { 2.5, 0 });
+    PolicyAccountStore::Handle spender = store.open("interest-checking", "Spender", 100, { 1.0, 200 });
+    PolicyAccountStore::Handle ledger = store.open("ledger", "Ledger", 0, { 0, 50 });
+    for (int i = 0; i < 100; ++i)
+        store.open("checking", "Filler", 10, { 0, 0 });
+    SelfTests::expect(store.size() == 103, "every opened account is stored");
+    SelfTests::expectThrows<invalid_argument>([&]() { store.open("brokerage", "Nobody", 0, { 0, 0 }); }, "unknown products are refused");
+    SelfTests::expectThrows<invalid_argument>([&]() {
+        store.visit({ Product::Savings, 7 }, [](auto& account) { return account.getBalance(); });
+    }, "a handle past the end is refused");
+
+    store.visit(saver, [](auto& account) { account.deposit(500); });
+    store.visit(spender, [](auto& account) { account.withdraw(50); });
+    SelfTests::expectThrows<runtime_error>([&]() {
+        store.visit(ledger, [](auto& account) { account.withdraw(60); });
+    }, "the ledger's overdraft limit holds");
+    SelfTests::expectThrows<runtime_error>([&]() {
+        store.visit(saver, [](auto& account) { account.withdraw(5000); });
+    }, "savings cannot be overdrawn");
+
+    size_t accrued = 0;
+    store.forEach([&](auto& account) { accrued += applyInterestIfAccrues(account) ? 1 : 0; });
+    SelfTests::expect(accrued == 2, "only interest-bearing products accrue");
+    SelfTests::expectNear(store.visit(saver, [](auto& account) { return account.getBalance(); }), 1537.5, "the stored account keeps its postings");
+    SelfTests::expectNear(store.visit(spender, [](auto& account) { return account.getBalance(); }), 50.5, "interest applies to the stored balance");
+    SelfTests::expectNear(store.visit(ledger, [](auto& account) { return account.getBalance(); }), 0, "a declined withdrawal changes nothing");
+}
+
+void testCommandParsing() {
+    SelfTests::expect(productOf("savings") == Product::Savings && productOf("ledger") == Product::Ledger, "product names resolve");
+    SelfTests::expect(productOf("interest-checking") == Product::InterestChecking, "hyphenated names resolve");
+    SelfTests::expect(productOf("Savings") == Product::Unknown && productOf("saving") == Product::Unknown
+        && productOf("") == Product::Unknown, "near misses are unknown");
+    for (size_t k = 0; k < 12; ++k)
+        SelfTests::expect(commandTable.find(commandNames[k], 99) == commandCodes[k], string("command word ") + commandNames[k]);
+    SelfTests::expect(commandTable.find("deposits", 99) == 99 && commandTable.find("x", 99) == 99, "other words fall back");
+
+    auto parse = [](const string& line, Command& command) { return CommandParser::parse(line.data(), line.data() + line.size(), command); };
+    Command command;
+    const string line = "  deposit Laurie 250.5\r";
+    SelfTests::expect(parse(line, command) && command.op == CommandOp::Deposit, "a deposit parses");
+    SelfTests::expect(string(command.owner, command.ownerLength) == "Laurie", "the owner points into the line");
+    SelfTests::expectNear(command.amount, 250.5, "one decimal place is tenths");
+    SelfTests::expect(parse("w Larry 20.05", command) && command.op == CommandOp::Withdraw, "letters work in lower case");
+    SelfTests::expectNear(command.amount, 20.05, "two decimal places are cents");
+    SelfTests::expect(parse("S Larry", command) && command.op == CommandOp::Show, "show takes no amount");
+    SelfTests::expect(parse("WITHDRAW Larry 1", command) && command.op == CommandOp::Withdraw
+        && parse("History Larry", command) && command.op == CommandOp::History, "words work in any case");
+    SelfTests::expect(!parse("withdrawal Larry 1", command), "words longer than any keyword are malformed");
+    SelfTests::expect(parse("exit", command) && command.op == CommandOp::Exit, "exit takes no owner");
+    SelfTests::expect(!parse("deposit Laurie", command), "a deposit needs an amount");
+    SelfTests::expect(!parse("deposit Laurie 1.2.3", command) && !parse("deposit Laurie -5", command), "amounts are plain decimals");
+    SelfTests::expect(!parse("deposit Laurie 1234567890123456789012", command), "overlong amounts are refused");
+    SelfTests::expect(!parse("show Larry extra", command) && !parse("transfer Laurie 5", command), "unknown shapes are malformed");
+
+    AccountBook book;
+    book.openAccount(AccountKind::Savings, "Laurie", 1000, 2.5, 1700000000);
+    book.openAccount(AccountKind::Checking, "Larry", 100, 50, 1700000000);
+    const string script = "deposit Laurie 100\nW Larry 500\nbogus\n\nshow Nobody\nI Laurie\nh Larry\nexit\ndeposit Laurie 1\n";
+    CommandDispatcher dispatcher(book);
+    CommandDispatcher::Stats stats = dispatcher.run(script.data(), script.size(), 1700000000);
+    SelfTests::expect(stats.executed == 3 && stats.declined == 1, "valid commands run and declines are counted");
+    SelfTests::expect(stats.malformed == 1 && stats.unknownOwners == 1, "blank lines are skipped, bad ones counted");
+    SelfTests::expectNear(book.getBalance(0), 1127.5, "nothing after exit runs");
+}
+
+void testInstrumentationLevels() {
+    SelfTests::expect(Instrumentation::level >= 0 && Instrumentation::level <= 2, "the level is 0, 1 or 2");
+    SelfTests::expect(Instrumentation::counters == (Instrumentation::level >= 1), "counters start at level 1");
+    SelfTests::expect(Instrumentation::spans == (Instrumentation::level >= 2)
+        && Instrumentation::lockProfiling == Instrumentation::spans, "diagnostics start at level 2");
+    SelfTests::expect(is_empty<BasicScopedSpan<false>>::value, "a compiled-out span carries no state");
+    SelfTests::expect(is_same<ScopedSpan, BasicScopedSpan<Instrumentation::spans>>::value, "spans follow the level");
+}
+
+void testCoreApi() {
+    const int64_t now = 1700000000;
+    SelfTests::expect(bank_core_api_version() == BANK_CORE_API_VERSION, "the library reports the header's version");
+    BankCore* core = bank_core_create();
+    SelfTests::expect(core != nullptr, "a core is created");
+    uint32_t saver = 0, spender = 0, unused = 0;
+    SelfTests::expect(bank_core_open_account(core, BANK_ACCOUNT_SAVINGS, "Saver", 100000, 2.0, &saver) == BANK_OK
+        && bank_core_open_account(core, BANK_ACCOUNT_CHECKING, "Spender", 5000, 100, &spender) == BANK_OK, "accounts open");
+    SelfTests::expect(bank_core_open_account(core, 7, "Nobody", 0, 0, &unused) == BANK_INVALID_REQUEST
+        && bank_core_open_account(core, BANK_ACCOUNT_SAVINGS, nullptr, 0, 0, &unused) == BANK_INVALID_REQUEST, "bad opens are refused");
+    SelfTests::expect(bank_core_account_count(core) == 2, "only valid opens create accounts");
+
+    const BankOperation operations[] = {
+        { BANK_OP_DEPOSIT, saver, 0, 0, 2550 },
+        { BANK_OP_TRANSFER, saver, spender, 0, 10000 },
+        { BANK_OP_WITHDRAW, spender, 0, 0, 30000 },
+        { BANK_OP_WITHDRAW, spender, 0, 0, 20000 },
+        { BANK_OP_INTEREST, spender, 0, 0, 0 },
+        { BANK_OP_INTEREST, saver, 0, 0, 0 },
+        { BANK_OP_BALANCE, 9, 0, 0, 0 },
+        { BANK_OP_DEPOSIT, saver, 0, 1, 100 },
+        { BANK_OP_DEPOSIT, saver, 0, 0, -100 },
+        { 42, saver, 0, 0, 100 },
+        { BANK_OP_TRANSFER, saver, saver, 0, 100 } };
+    const size_t count = sizeof(operations) / sizeof(operations[0]);
+    BankResult results[count];
+    SelfTests::expect(bank_core_execute(core, operations, results, count, now) == 4, "four operations succeed");
+    const int32_t statuses[count] = { BANK_OK, BANK_OK, BANK_DECLINED, BANK_OK, BANK_INVALID_REQUEST, BANK_OK,
+        BANK_UNKNOWN_ACCOUNT, BANK_INVALID_REQUEST, BANK_INVALID_REQUEST, BANK_INVALID_REQUEST, BANK_INVALID_REQUEST };
+    for (size_t i = 0; i < count; ++i)
+        SelfTests::expect(results[i].status == statuses[i], "status of operation " + to_string(i));
+    SelfTests::expect(results[0].transaction_id != 0 && results[2].transaction_id == 0, "ids are returned for postings only");
+    SelfTests::expect(results[0].balance_cents == 102550 && results[1].balance_cents == 92550, "balances follow the batch");
+    SelfTests::expect(results[3].balance_cents == -5000, "checking may use its overdraft");
+    SelfTests::expect(results[5].balance_cents == 94401 && results[6].balance_cents == 0, "interest posts in cents");
+    SelfTests::expect(bank_core_execute(nullptr, operations, results, count, now) == 0, "a null core does nothing");
+    bank_core_destroy(core);
+    bank_core_destroy(nullptr);
+}
+
+void testWireFormat() {
+    const int64_t now = 1700000000;
+    BankCore* core = bank_core_create();
+    uint32_t saver = 0, spender = 0;
+    bank_core_open_account(core, BANK_ACCOUNT_SAVINGS, "Saver", 100000, 2.0, &saver);
+    bank_core_open_account(core, BANK_ACCOUNT_CHECKING, "Spender", 5000, 0, &spender);
+    const BankOperation operations[] = {
+        { BANK_OP_DEPOSIT, saver, 0, 0, 500 },
+        { BANK_OP_WITHDRAW, spender, 0, 0, 9000 },
+        { BANK_OP_BALANCE, spender, 0, 0, 0 } };
+
+    vector<uint64_t> request, response;
+    vector<BankOperation> scratch;
+    size_t size = WireWriter::encode(operations, 3, request);
+    SelfTests::expect(size == 16 + 3 * 24, "a message is a header and packed records");
+    SelfTests::expect(executeWireMessage(core, request.data(), size, response, scratch, now) == WireError::None, "a valid message runs");
+    WireView<BankResult> results;
+    SelfTests::expect(WireView<BankResult>::open(response.data(), response.size() * sizeof(uint64_t), results) == WireError::None
+        && results.size() == 3 && results.contiguous(), "the response is a valid result message");
+    SelfTests::expect(results[0].status == BANK_OK && results[0].balance_cents == 100500, "results line up with commands");
+    SelfTests::expect(results[1].status == BANK_DECLINED && results[2].balance_cents == 5000, "declines are reported per record");
+
+    auto openCommands = [&](const vector<uint64_t>& buffer, size_t bytes, size_t offset = 0) {
+        WireView<BankOperation> view;
+        return WireView<BankOperation>::open(reinterpret_cast<const unsigned char*>(buffer.data()) + offset, bytes, view);
+    };
+    auto header = [&]() -> WireHeader& { return *reinterpret_cast<WireHeader*>(request.data()); };
+    auto reset = [&]() { WireWriter::encode(operations, 3, request); };
+    SelfTests::expect(openCommands(request, 12) == WireError::Truncated, "a partial header is truncated");
+    SelfTests::expect(openCommands(request, size - 1) == WireError::Truncated, "a partial record is truncated");
+    SelfTests::expect(openCommands(request, size - 8, 4) == WireError::Misaligned, "records must be 8-byte aligned");
+    header().magic ^= 1;
+    SelfTests::expect(openCommands(request, size) == WireError::BadMagic, "the magic is checked");
+    reset();
+    header().major = 2;
+    SelfTests::expect(openCommands(request, size) == WireError::UnsupportedVersion, "a new major version is refused");
+    reset();
+    header().kind = static_cast<uint16_t>(WireKind::Results);
+    SelfTests::expect(openCommands(request, size) == WireError::WrongKind, "results are not commands");
+    reset();
+    header().recordSize = 16;
+    SelfTests::expect(openCommands(request, size) == WireError::RecordTooSmall, "records cannot shrink");
+    header().recordSize = 28;
+    SelfTests::expect(openCommands(request, size) == WireError::RecordTooSmall, "the stride keeps records aligned");
+    reset();
+    header().count = UINT32_MAX;
+    SelfTests::expect(openCommands(request, size) == WireError::Truncated, "a huge count cannot wrap the length");
+    reset();
+    WireWriter::begin<BankOperation>(request, 1)->op = 9;
+    SelfTests::expect(openCommands(request, 40) == WireError::BadRecord, "unknown op codes are refused");
+    WireWriter::begin<BankOperation>(request, 1)->reserved = 1;
+    SelfTests::expect(openCommands(request, 40) == WireError::BadRecord, "reserved fields must be zero");
+    SelfTests::expect(string(wireErrorName(WireError::BadRecord)) == "bad record", "errors have names");
+
+    // A newer minor version with 32-byte records: the known prefix is used, the tail ignored
+    vector<uint64_t> newer(2 + 3 * 4, ~0ull);
+    WireHeader& grown = *reinterpret_cast<WireHeader*>(newer.data());
+    grown = { WireHeader::magicValue, WireHeader::majorVersion, 1, static_cast<uint16_t>(WireKind::Commands), 32, 0, 3 };
+    for (size_t i = 0; i < 3; ++i)
+        memcpy(reinterpret_cast<unsigned char*>(newer.data()) + 16 + i * 32, &operations[i], sizeof(BankOperation));
+    SelfTests::expect(executeWireMessage(core, newer.data(), newer.size() * sizeof(uint64_t), response, scratch, now) == WireError::None,
+        "a newer minor version is accepted");
+    SelfTests::expect(WireView<BankResult>::open(response.data(), response.size() * sizeof(uint64_t), results) == WireError::None
+        && results.size() == 3 && results[0].balance_cents == 101000, "its records run through the known layout");
+    bank_core_destroy(core);
+}
+
+/**
+ * Benchmark entry point: "bench [accounts]".
+ */
+int runBenchmarks(int argc, char* argv[]) {
+    size_t accounts = argc > 2 ? static_cast<size_t>(stoull(argv[2])) : 1000000;
+    int64_t now = static_cast<int64_t>(time(nullptr));
+    mt19937_64 rng(42);
+    if (!BenchmarkRunner::hasHardwareCounters())
+        cout << "Hardware counters unavailable; reporting time only\n";
+    cout << "Instrumentation level " << Instrumentation::level << ": counters " << (Instrumentation::counters ? "on" : "off")
+        << ", spans " << (Instrumentation::spans ? "on" : "off") << ", lock profiling " << (Instrumentation::lockProfiling ? "on" : "off")
+        << ", allocation tracking " << (Instrumentation::allocations ? "on" : "off") << "\n";
+
+    AccountBook book;
+    uniform_int_distribution<int64_t> age(0, 13 * AccountBook::secondsPerMonth);
+    for (size_t i = 0; i < accounts; ++i) {
+        AccountKind kind = i % 2 ? AccountKind::Checking : AccountKind::Savings;
+        book.openAccount(kind, "Customer" + to_string(i), 1000, kind == AccountKind::Savings ? 2.5 : 500, now - age(rng));
+    }
+
+    vector<AccountBook::AccountId> dormant;
+    BenchmarkRunner::run("dormant scan (12 months)", accounts, [&]() {
+        dormant = book.findDormant(AccountBook::dormancyCutoff(now, 12));
+    });
+    BenchmarkRunner::run("mark dormant", dormant.size(), [&]() {
+        book.setStatus(dormant, AccountStatus::Dormant);
+    });
+    cout << dormant.size() << " of " << accounts << " accounts flagged dormant\n";
+
+    FeeEngine fees;
+    fees.addRule({ AccountKind::Checking, FeeCondition::Maintenance, 5.0, 0.0 });
+    fees.addRule({ AccountKind::Savings, FeeCondition::MinimumBalance, 10.0, 1500.0 });
+    fees.addRule({ AccountKind::Checking, FeeCondition::Overdrawn, 35.0, 0.0 });
+    fees.addRule({ AccountKind::Savings, FeeCondition::Dormant, 15.0, 0.0 });
+    size_t charged = 0;
+    BenchmarkRunner::run("fee cycle (4 rules)", accounts, [&]() {
+        charged = fees.runCycle(book, 1, now);
+    });
+    BenchmarkRunner::run("fee cycle rerun (idempotent)", accounts, [&]() {
+        charged += fees.runCycle(book, 1, now);
+    });
+    cout << charged << " fees posted\n";
+
+    uniform_int_distribution<AccountBook::AccountId> anyAccount(0, static_cast<AccountBook::AccountId>(accounts - 1));
+    for (size_t i = 0; i < accounts; ++i) {
+        AccountBook::AccountId from = anyAccount(rng);
+        AccountBook::AccountId to = anyAccount(rng);
+        if (from != to && book.getKind(from) == AccountKind::Checking)
+            book.transfer(from, to, 1.0, now);
+    }
+    TransferGraph graph;
+    BenchmarkRunner::run("transfer graph build", book.getHistory().size(), [&]() {
+        graph.refresh(book);
+    });
+    vector<AccountBook::AccountId> components;
+    BenchmarkRunner::run("connected components", graph.edgeCount(), [&]() {
+        components = graph.connectedComponents();
+    });
+    size_t fanOutSize = 0;
+    BenchmarkRunner::run("3-hop fan-out", 1, [&]() {
+        for (const auto& level : graph.fanOut(1, 3))
+            fanOutSize += level.size();
+    });
+    size_t cycles = 0;
+    BenchmarkRunner::run("cycle search (length <= 4)", graph.vertexCount(), [&]() {
+        cycles = graph.findCycles(4, 1000).size();
+    });
+    cout << graph.edgeCount() << " transfer edges, " << fanOutSize << " accounts within 3 hops, "
+        << cycles << " cycles found\n";
+
+    vector<AccountBook::AccountId> matches;
+    AccountFilter overdrawn("kind == checking and balance < -200 and overdraft > 400");
+    BenchmarkRunner::run("filter: overdrawn checking", accounts, [&]() {
+        matches = overdrawn.run(book);
+    });
+    AccountFilter lowSavings("balance < 1200 and kind == savings");
+    BenchmarkRunner::run("filter: low-balance savings", accounts, [&]() {
+        matches = lowSavings.run(book);
+    });
+    cout << matches.size() << " low-balance savings accounts\n";
+
+    ProductCatalog catalog;
+    book.setCatalog(&catalog);
+    ProductCatalog::ProductId premierSavings = catalog.addProduct("premier-savings", AccountKind::Savings, 3.0, 0.0);
+    for (size_t i = 0; i < 1000; ++i)
+        book.openAccount(premierSavings, "Premier" + to_string(i), 5000, now);
+    BenchmarkRunner::run("product rate change", 1, [&]() {
+        catalog.setInterestRate(premierSavings, 3.25);
+    });
+    size_t credited = 0;
+    BenchmarkRunner::run("bulk interest run", book.size(), [&]() {
+        credited = book.applyInterestBulk(now);
+    });
+    cout << credited << " savings accounts credited, catalog version " << catalog.snapshot()->version << "\n";
+
+    vector<uint64_t> disputed;
+    for (size_t i = 0; i < 100000 && i < accounts; ++i)
+        disputed.push_back(book.deposit(anyAccount(rng), 42.0, now));
+    disputed.push_back(book.getHistory().idAt(0));  // an old id, served from the range index
+    BenchmarkRunner::run("reverse by transaction id", disputed.size(), [&]() {
+        for (uint64_t id : disputed)
+            book.reverse(id, now);
+    });
+
+    vector<Posting> payroll(accounts);
+    for (size_t i = 0; i < accounts; ++i)
+        payroll[i] = { anyAccount(rng), 2500.0 };
+    BulkPostResult posted;
+    BenchmarkRunner::run("bulk payroll posting", payroll.size(), [&]() {
+        posted = book.postBulk(payroll, now);
+    });
+    cout << posted.posted << " postings over " << posted.accounts << " accounts, "
+        << posted.rejected.size() << " rejected\n";
+
+    WorkloadGenerator::Config workload;
+    workload.accounts = static_cast<uint32_t>(accounts);
+    workload.operations = accounts;
+    Trace trace;
+    BenchmarkRunner::run("generate zipfian trace", workload.operations, [&]() {
+        trace = WorkloadGenerator::generate(workload);
+    });
+    BenchmarkRunner::run("replay trace (max speed)", trace.records.size(), [&]() {
+        TraceReplayer::replay(trace, book, TraceReplayer::Pace::AsFastAsPossible);
+    });
+
+    CustomerRegistry registry(book);
+    for (size_t i = 0; i < accounts; i += 2) {
+        CustomerRegistry::HouseholdId household = i % 4 == 0 ? registry.addHousehold() : CustomerRegistry::HouseholdId(registry.householdCount() - 1);
+        CustomerRegistry::CustomerId customer = registry.addCustomer("Customer" + to_string(i), household);
+        registry.linkAccount(customer, static_cast<AccountBook::AccountId>(i));
+        if (i + 1 < accounts)
+            registry.linkAccount(customer, static_cast<AccountBook::AccountId>(i + 1));
+    }
+    BenchmarkRunner::run("deposit with household rollup", accounts, [&]() {
+        for (size_t i = 0; i < accounts; ++i)
+            book.deposit(anyAccount(rng), 10.0, now);
+    });
+
+    uniform_int_distribution<int> cashCents(100, 950000);
+    BenchmarkRunner::run("deposit, cash amounts", accounts, [&]() {
+        for (size_t i = 0; i < accounts; ++i)
+            book.deposit(anyAccount(rng), cashCents(rng) / 100.0, now);
+    });
+    size_t reported = 0;
+    CashReportingMonitor monitor(book, [&](const vector<CashReportingMonitor::Candidate>& batch) {
+        reported += batch.size();
+    }, &registry);
+    BenchmarkRunner::run("deposit with cash reporting", accounts, [&]() {
+        for (size_t i = 0; i < accounts; ++i)
+            book.deposit(anyAccount(rng), cashCents(rng) / 100.0, now + static_cast<int64_t>(i * 86400 / accounts));
+    });
+    BenchmarkRunner::run("cash reporting end-of-day flush", monitor.customersToday(), [&]() {
+        monitor.flushAll();
+    });
+    cout << reported << " cash reporting candidates\n";
+
+    // Virtual hierarchy against policy accounts: the same deposit/withdraw mix
+    {
+        const size_t count = 1024;
+        const size_t rounds = max<size_t>(1, accounts / count);
+        vector<unique_ptr<BankAccount>> virtualAccounts;
+        for (size_t i = 0; i < count; ++i)
+            virtualAccounts.push_back(AccountFactory::createAccount(i % 2 ? "checking" : "savings", "Virtual", 1000, i % 2 ? 500 : 2.5));
+        BenchmarkRunner::run("virtual deposit+withdraw", count * rounds * 2, [&]() {
+            for (size_t r = 0; r < rounds; ++r)
+                for (auto& account : virtualAccounts) {
+                    account->deposit(2.0);
+                    account->withdraw(1.0);
+                }
+        });
+        auto mixed = [&](const char* savings, const char* checking, const char* label) {
+            PolicyAccountStore store;
+            for (size_t i = 0; i < count; ++i)
+                store.open(i % 2 ? checking : savings, "Policy", 1000, i % 2 ? ProductTerms{ 0, 500 } : ProductTerms{ 2.5, 0 });
+            BenchmarkRunner::run(label, count * rounds * 2, [&]() {
+                for (size_t r = 0; r < rounds; ++r)
+                    store.forEach([](auto& account) {
+                        account.deposit(2.0);
+                        account.withdraw(1.0);
+                    });
+            });
+        };
+        mixed("savings", "checking", "policy deposit+withdraw");
+        mixed("interest-checking", "ledger", "policy, half without history");
+    }
+
+    // Mixed command stream: stream extraction with string compares against the table-driven parser
+    {
+        AccountBook commandBook;
+        for (size_t i = 0; i < 1024; ++i)
+            commandBook.openAccount(i % 2 ? AccountKind::Checking : AccountKind::Savings, "Customer" + to_string(i), 1000, i % 2 ? 500 : 2.5, now);
+        static const char* const spellings[] = { "deposit", "withdraw", "show", "history", "interest", "D", "w", "S", "h", "I" };
+        uniform_int_distribution<int> pickSpelling(0, 9);
+        uniform_int_distribution<int> pickOwner(0, 1023);
+        ostringstream stream;
+        size_t lines = accounts;
+        for (size_t i = 0; i < lines; ++i) {
+            int spelling = pickSpelling(rng);
+            stream << spellings[spelling] << " Customer" << pickOwner(rng);
+            if (spelling % 5 < 2) stream << " " << pickOwner(rng) % 200 << "." << setw(2) << setfill('0') << pickOwner(rng) % 100 << setfill(' ');
+            stream << "\n";
+        }
+        string text = stream.str();
+
+        unordered_map<string, AccountBook::AccountId> owners;
+        for (size_t id = 0; id < commandBook.size(); ++id)
+            owners.emplace(commandBook.getOwner(static_cast<AccountBook::AccountId>(id)), static_cast<AccountBook::AccountId>(id));
+        double checksum = 0;
+        BenchmarkRunner::run("commands: istream + compares", lines, [&]() {
+            istringstream in(text);
+            string line, op, owner;
+            while (getline(in, line)) {
+                istringstream fields(line);
+                double amount = 0;
+                fields >> op >> owner;
+                auto found = owners.find(owner);
+                if (found == owners.end()) continue;
+                AccountBook::AccountId id = found->second;
+                try {
+                    if (op == "deposit" || op == "D" || op == "d") { fields >> amount; commandBook.deposit(id, amount, now); }
+                    else if (op == "withdraw" || op == "W" || op == "w") { fields >> amount; commandBook.withdraw(id, amount, now); }
+                    else if (op == "show" || op == "S" || op == "s") checksum += commandBook.getBalance(id);
+                    else if (op == "history" || op == "H" || op == "h") checksum += static_cast<double>(commandBook.getHistory().size());
+                    else if (op == "interest" || op == "I" || op == "i") {
+                        if (commandBook.getKind(id) == AccountKind::Savings) commandBook.applyInterest(id, now);
+                    }
+                }
+                catch (const runtime_error&) {}
+            }
+        });
+        CommandDispatcher dispatcher(commandBook);
+        CommandDispatcher::Stats stats;
+        BenchmarkRunner::run("commands: perfect-hash dispatch", lines, [&]() {
+            stats = dispatcher.run(text.data(), text.size(), now);
+        });
+        size_t parsed = 0;
+        BenchmarkRunner::run("commands: parse only", lines, [&]() {
+            Command command;
+            const char* end = text.data() + text.size();
+            for (const char* line = text.data(); line < end;) {
+                const char* lineEnd = static_cast<const char*>(memchr(line, '\n', static_cast<size_t>(end - line)));
+                parsed += CommandParser::parse(line, lineEnd, command);
+                line = lineEnd + 1;
+            }
+        });
+        cout << stats.executed << " commands executed, " << stats.declined << " declined, " << stats.malformed
+            << " malformed, " << parsed << " parsed (checksum " << fixed << setprecision(2) << checksum + stats.checksum << ")\n";
+    }
+
+    // Wire messages against text lines carrying the same commands: decode alone, then
+    // decode and execute through the C interface with results written in place
+    {
+        BankCore* core = bank_core_create();
+        uint32_t account = 0;
+        for (size_t i = 0; i < 1024; ++i)
+            bank_core_open_account(core, i % 2 ? BANK_ACCOUNT_CHECKING : BANK_ACCOUNT_SAVINGS,
+                ("Customer" + to_string(i)).c_str(), 100000, i % 2 ? 500 : 2.5, &account);
+        static const char* const textOps[] = { "deposit", "withdraw", "show", "interest" };
+        static const uint32_t wireOps[] = { BANK_OP_DEPOSIT, BANK_OP_WITHDRAW, BANK_OP_BALANCE, BANK_OP_INTEREST };
+        uniform_int_distribution<int> pickOp(0, 3);
+        uniform_int_distribution<uint32_t> pickAccount(0, 1023);
+        uniform_int_distribution<int64_t> pickCents(1, 20000);
+        const size_t lines = accounts;
+        vector<BankOperation> operations(lines);
+        ostringstream stream;
+        for (size_t i = 0; i < lines; ++i) {
+            int op = pickOp(rng);
+            uint32_t id = pickAccount(rng);
+            int64_t cents = op < 2 ? pickCents(rng) : 0;
+            operations[i] = BankOperation{ wireOps[op], id, 0, 0, cents };
+            stream << textOps[op] << " Customer" << id;
+            if (op < 2) stream << " " << cents / 100 << "." << setw(2) << setfill('0') << cents % 100 << setfill(' ');
+            stream << "\n";
+        }
+        string text = stream.str();
+        vector<uint64_t> request, response;
+        size_t requestBytes = WireWriter::encode(operations.data(), operations.size(), request);
+
+        unordered_map<string, uint32_t> owners;
+        for (uint32_t id = 0; id < 1024; ++id)
+            owners.emplace("Customer" + to_string(id), id);
+        double textChecksum = 0;
+        BenchmarkRunner::run("text decode: parse + owner lookup", lines, [&]() {
+            Command command;
+            string owner;
+            const char* end = text.data() + text.size();
+            for (const char* line = text.data(); line < end;) {
+                const char* lineEnd = static_cast<const char*>(memchr(line, '\n', static_cast<size_t>(end - line)));
+                if (CommandParser::parse(line, lineEnd, command)) {
+                    owner.assign(command.owner, command.ownerLength);
+                    auto found = owners.find(owner);
+                    if (found != owners.end())
+                        textChecksum += found->second + command.amount;
+                }
+                line = lineEnd + 1;
+            }
+        });
+        double wireChecksum = 0;
+        WireError error = WireError::None;
+        BenchmarkRunner::run("wire decode: validate + read", lines, [&]() {
+            WireView<BankOperation> view;
+            error = WireView<BankOperation>::open(request.data(), requestBytes, view);
+            for (size_t i = 0; i < view.size(); ++i)
+                wireChecksum += view[i].account + view[i].amount_cents / 100.0;
+        });
+        vector<BankOperation> scratch;
+        BenchmarkRunner::run("wire execute: C API in place", lines, [&]() {
+            error = executeWireMessage(core, request.data(), requestBytes, response, scratch, now);
+        });
+        WireView<BankResult> results;
+        WireError resultError = WireView<BankResult>::open(response.data(), response.size() * sizeof(uint64_t), results);
+        size_t ok = 0;
+        for (size_t i = 0; i < results.size(); ++i)
+            ok += results[i].status == BANK_OK;
+        cout << requestBytes / 1024 << " KB wire vs " << text.size() / 1024 << " KB text, wire " << wireErrorName(error)
+            << ", results " << wireErrorName(resultError) << ", " << ok << " of " << results.size() << " ok (checksums "
+            << fixed << setprecision(2) << textChecksum << " / " << wireChecksum << ")\n";
+        bank_core_destroy(core);
+    }
+
+    // C interface per-operation overhead for batch sizes 1 to 1024. Balance queries do
+    // almost no work, so their rows are the cost of the call, the lock and the result.
+    // The call goes through a volatile pointer so it cannot be inlined, as across FFI.
+    {
+        BankCore* core = bank_core_create();
+        uint32_t account = 0;
+        for (size_t i = 0; i < 1024; ++i)
+            bank_core_open_account(core, BANK_ACCOUNT_CHECKING, ("Ffi" + to_string(i)).c_str(), 100000, 500, &account);
+        const size_t total = max<size_t>(1024, accounts * 4 / 1024 * 1024);
+        vector<BankOperation> queries(1024), deposits(1024);
+        vector<BankResult> results(1024);
+        for (size_t i = 0; i < queries.size(); ++i) {
+            queries[i] = BankOperation{ BANK_OP_BALANCE, static_cast<uint32_t>(i), 0, 0, 0 };
+            deposits[i] = BankOperation{ BANK_OP_DEPOSIT, static_cast<uint32_t>(i), 0, 0, 100 };
+        }
+        size_t (*volatile execute)(BankCore*, const BankOperation*, BankResult*, size_t, int64_t) = bank_core_execute;
+        size_t succeeded = 0;
+        auto batches = [&](const string& name, const vector<BankOperation>& operations, size_t batch) {
+            BenchmarkRunner::run(name + ", batch " + to_string(batch), total, [&]() {
+                for (size_t done = 0; done < total; done += batch)
+                    succeeded += execute(core, operations.data(), results.data(), batch, now);
+            });
+        };
+        for (size_t batch = 1; batch <= 1024; batch *= 4)
+            batches("C API balance", queries, batch);
+        batches("C API deposit", deposits, 1);
+        batches("C API deposit", deposits, 1024);
+        cout << succeeded << " operations succeeded, account 0 balance " << results[0].balance_cents << " cents\n";
+        bank_core_destroy(core);
+    }
+
+    // Profiler overhead: the same deposits unprofiled and sampled at 100 Hz
+    {
+        AccountBook sampled;
+        for (size_t i = 0; i < 1024; ++i)
+            sampled.openAccount(AccountKind::Checking, "Sampled" + to_string(i), 1000, 500, now);
+        auto depositLoop = [&]() {
+            for (size_t i = 0; i < accounts * 4; ++i)
+                sampled.deposit(static_cast<AccountBook::AccountId>(i & 1023), 1.0, now);
+        };
+        BenchmarkRunner::run("book deposit, profiler off", accounts * 4, depositLoop);
+        bool profiling = SamplingProfiler::start(100);
+        BenchmarkRunner::run("book deposit, profiler at 100 Hz", accounts * 4, depositLoop);
+        SamplingProfiler::stop();
+        if (profiling)
+            cout << SamplingProfiler::sampleCount() << " stack samples, " << SamplingProfiler::droppedCount() << " dropped\n";
+    }
+
+    // Lookups and withdrawal checks must stay allocation-free
+    {
+        AllocationScope scope;
+        double total = 0;
+        AccountBook::AccountId owner;
+        size_t row;
+        for (size_t i = 0; i < 1000; ++i) {
+            AccountBook::AccountId id = anyAccount(rng);
+            total += book.getBalance(id) + book.getInterestRate(id);
+            if (book.findTransaction(book.getHistory().idAt(i), owner, row))
+                total += book.getHistory().amountAt(row);
+        }
+        scope.requireNone("balance and transaction lookups");
+        cout << "lookups allocation-free (checksum " << fixed << setprecision(2) << total << ")\n";
+    }
+
+    // Compiled-out spans against no span at all and a compiled-in span with tracing off
+    {
+        volatile uint64_t sink = 0;
+        const size_t spins = accounts * 16;
+        BenchmarkRunner::run("loop, no span", spins, [&]() {
+            for (size_t i = 0; i < spins; ++i)
+                sink = sink + i;
+        });
+        BenchmarkRunner::run("loop, span compiled out", spins, [&]() {
+            for (size_t i = 0; i < spins; ++i) {
+                BasicScopedSpan<false> span("loop");
+                sink = sink + i;
+            }
+        });
+        BenchmarkRunner::run("loop, span compiled in, off", spins, [&]() {
+            for (size_t i = 0; i < spins; ++i) {
+                BasicScopedSpan<true> span("loop");
+                sink = sink + i;
+            }
+        });
+        static_assert(sizeof(BasicScopedSpan<false>) == 1, "A compiled-out span must be an empty object");
+    }
+
+    // Tracing overhead: the same deposits with spans off and on
+    AccountBook traced;
+    for (size_t i = 0; i < 1024; ++i)
+        traced.openAccount(AccountKind::Savings, "Traced" + to_string(i), 1000, 2.5, now);
+    SavingsAccount tracedAccount("Traced", 1000, 2.5);
+    BenchmarkRunner::run("book deposit, tracing off", accounts, [&]() {
+        for (size_t i = 0; i < accounts; ++i)
+            traced.deposit(static_cast<AccountBook::AccountId>(i & 1023), 1.0, now);
+    });
+    BenchmarkRunner::run("account deposit, tracing off", accounts, [&]() {
+        for (size_t i = 0; i < accounts; ++i)
+            tracedAccount.deposit(1.0);
+    });
+    SpanTracer::enable();
+    BenchmarkRunner::run("book deposit, tracing on", accounts, [&]() {
+        for (size_t i = 0; i < accounts; ++i)
+            traced.deposit(static_cast<AccountBook::AccountId>(i & 1023), 1.0, now);
+    });
+    BenchmarkRunner::run("account deposit, tracing on", accounts, [&]() {
+        for (size_t i = 0; i < accounts; ++i)
+            tracedAccount.deposit(1.0);
+    });
+    SpanTracer::disable();
+    ostringstream timeline;
+    BenchmarkRunner::run("trace dump (one ring buffer)", 1 << 16, [&]() {
+        SpanTracer::dump(timeline);
+    });
+    SpanTracer::clear();
+    cout << timeline.str().size() / 1024 << " KB of trace events\n";
+
+    BookMetrics bookMetrics(book);
+    ostringstream scrape;
+    BenchmarkRunner::run("metrics scrape", 1, [&]() {
+        Metrics::render(scrape);
+    });
+    cout << scrape.str().size() << " bytes of metrics, " << Metrics::total(Metrics::Deposits) << " deposits counted\n";
+    cout << registry.customerCount() << " customers in " << registry.householdCount()
+        << " households, household 0 balance $" << fixed << setprecision(2) << registry.getHouseholdBalance(0) << "\n";
+    return 0;
+}
+
+/**
+ * TPC-B entry point: "tpcb [accounts] [threads] [transactions]".
+ */
+int runTpcb(int argc, char* argv[]) {
+    size_t accounts = argc > 2 ? static_cast<size_t>(stoull(argv[2])) : 100000;
+    size_t threads = argc > 3 ? static_cast<size_t>(stoull(argv[3])) : max<size_t>(1, thread::hardware_concurrency());
+    size_t transactions = argc > 4 ? static_cast<size_t>(stoull(argv[4])) : 1000000;
+    if (threads == 0) {
+        cout << "Usage: tpcb [accounts] [threads >= 1] [transactions]\n";
+        return 1;
+    }
+
+    TpcbDriver driver(accounts);
+    TpcbDriver::Result result = driver.run(threads, transactions);
+    cout << "TPC-B: " << driver.accountCount() << " accounts, " << threads << " threads\n"
+        << fixed << setprecision(0) << "  TPS:        " << result.committed / result.seconds << "\n"
+        << "  committed:  " << result.committed << "\n"
+        << "  declined:   " << result.declined << "\n"
+        << setprecision(2) << "  latency us: p50 " << result.latency.p50 << "  p95 " << result.latency.p95
+        << "  p99 " << result.latency.p99 << "  max " << result.latency.max << "\n";
+    driver.printContention(cout, 5);
+    return 0;
+}
+
+/**
+ * SmallBank entry point: "smallbank [customers] [threads] [transactions] [hotspot %] [hotspot size]".
+ */
+int runSmallBank(int argc, char* argv[]) {
+    SmallBankDriver::Config config;
+    config.threads = max<size_t>(1, thread::hardware_concurrency());
+    if (argc > 2) config.customers = static_cast<size_t>(stoull(argv[2]));
+    if (argc > 3) config.threads = static_cast<size_t>(stoull(argv[3]));
+    if (argc > 4) config.transactions = static_cast<size_t>(stoull(argv[4]));
+    if (argc > 5) config.hotspotProbability = stod(argv[5]) / 100.0;
+    if (argc > 6) config.hotspotSize = static_cast<size_t>(stoull(argv[6]));
+    if (config.threads == 0 || config.customers == 0 || config.hotspotSize == 0) {
+        cout << "Usage: smallbank [customers >= 1] [threads >= 1] [transactions] [hot %] [hot customers >= 1]\n";
+        return 1;
+    }
+
+    SmallBankDriver driver(config);
+    SmallBankDriver::Result result = driver.run();
+    size_t committed = 0;
+    cout << "SmallBank: " << config.customers << " customers, " << config.threads << " threads, "
+        << fixed << setprecision(0) << config.hotspotProbability * 100 << "% on " << config.hotspotSize << " hot customers\n";
+    cout << left << setw(18) << "  transaction" << right << setw(12) << "attempted" << setw(12) << "txn/s"
+        << setw(11) << "declined" << setw(10) << "aborted" << "\n";
+    for (int t = 0; t < SmallBankDriver::TxnTypeCount; ++t) {
+        const auto& stats = result.types[t];
+        size_t ok = stats.attempted - stats.declined - stats.aborted;
+        committed += ok;
+        double attempted = stats.attempted ? static_cast<double>(stats.attempted) : 1.0;
+        cout << "  " << left << setw(16) << SmallBankDriver::typeName(t) << right << setw(12) << stats.attempted
+            << setw(12) << setprecision(0) << ok / result.seconds
+            << setw(10) << setprecision(2) << 100.0 * stats.declined / attempted << "%"
+            << setw(9) << 100.0 * stats.aborted / attempted << "%\n";
+    }
+    cout << setprecision(0) << "  total committed/s: " << committed / result.seconds << "\n"
+        << setprecision(2) << "  latency us: p50 " << result.latency.p50 << "  p95 " << result.latency.p95
+        << "  p99 " << result.latency.p99 << "  max " << result.latency.max << "\n";
+    driver.printContention(cout, 5);
+    return 0;
+}
+
+/**
+ * Trace tools:
+ *   "generate <file> [accounts] [operations] [zipf theta]" writes a synthetic trace;
+ *   "replay <file> [ops/sec | recorded]" replays a trace into a fresh book, as fast as
+ *   possible unless a rate or "recorded" timing is given.
+ */
+int runTraceTool(int argc, char* argv[]) {
+    string mode = argv[1];
+    if (argc < 3) {
+        cout << "Usage: " << mode << " <file> ...\n";
+        return 1;
+    }
+    if (mode == "generate") {
+        WorkloadGenerator::Config config;
+        if (argc > 3) config.accounts = static_cast<uint32_t>(stoul(argv[3]));
+        if (argc > 4) config.operations = static_cast<size_t>(stoull(argv[4]));
+        if (argc > 5) config.zipfTheta = stod(argv[5]);
+        WorkloadGenerator::generate(config).save(argv[2]);
+        cout << "Wrote " << config.operations << " operations over " << config.accounts << " accounts to " << argv[2] << "\n";
+        return 0;
+    }
+
+    Trace trace = Trace::load(argv[2]);
+    AccountBook book;
+    BookMetrics bookMetrics(book);
+    int64_t now = static_cast<int64_t>(time(nullptr));
+    book.openAccount(AccountKind::Savings, "Laurie", 5000, 2.5, now);
+    book.openAccount(AccountKind::Checking, "Larry", 1000, 500, now);
+    book.openAccount(AccountKind::Savings, "David", 10000, 2.5, now);
+    book.openAccount(AccountKind::Checking, "Luis", 2000, 500, now);
+    try {
+        TraceReplayer::openTraceAccounts(trace, book, now);
+    }
+    catch (const invalid_argument& e) {
+        cout << e.what() << "\n";
+        return 1;
+    }
+
+    TraceReplayer::Pace pace = TraceReplayer::Pace::AsFastAsPossible;
+    double rate = 0;
+    if (argc > 3 && string(argv[3]) == "recorded") pace = TraceReplayer::Pace::Recorded;
+    else if (argc > 3) {
+        pace = TraceReplayer::Pace::FixedRate;
+        try { rate = stod(argv[3]); }
+        catch (const exception&) { rate = 0; }
+        if (!(rate > 0)) {
+            cout << "Usage: replay <file> [ops/sec > 0 | recorded]\n";
+            return 1;
+        }
+    }
+    TraceReplayer::Stats stats = TraceReplayer::replay(trace, book, pace, rate);
+    cout << "Replayed " << stats.operations << " operations in " << fixed << setprecision(3) << stats.seconds << " s ("
+        << setprecision(0) << stats.operations / max(stats.seconds, 1e-9) << " ops/s), "
+        << stats.declined << " declined, " << stats.unknownAccounts << " unknown accounts, max lag "
+        << setprecision(2) << stats.maxLagMs << " ms\n";
+    return 0;
+}
+
+/**
+ * Command stream entry point: "commands <file>" runs a text command file, one
+ * "operation owner [amount]" per line, against the demo customers.
+ */
+int runCommands(int argc, char* argv[]) {
+    if (argc < 3) {
+        cout << "Usage: commands <file>\n";
+        return 1;
+    }
+    ifstream in(argv[2], ios::binary);
+    if (!in) {
+        cout << "Cannot open " << argv[2] << "\n";
+        return 1;
+    }
+    string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    int64_t now = static_cast<int64_t>(time(nullptr));
+    AccountBook book;
+    book.openAccount(AccountKind::Savings, "Laurie", 5000, 2.5, now);
+    book.openAccount(AccountKind::Checking, "Larry", 1000, 500, now);
+    book.openAccount(AccountKind::Savings, "David", 10000, 2.5, now);
+    book.openAccount(AccountKind::Checking, "Luis", 2000, 500, now);
+    CommandDispatcher dispatcher(book);
+    CommandDispatcher::Stats stats = dispatcher.run(text.data(), text.size(), now);
+    cout << stats.executed << " commands executed, " << stats.declined << " declined, " << stats.unknownOwners
+        << " unknown owners, " << stats.malformed << " malformed\n";
+    for (size_t id = 0; id < book.size(); ++id)
+        cout << "  " << left << setw(8) << book.getOwner(static_cast<AccountBook::AccountId>(id)) << right << " $" << fixed << setprecision(2)
+            << book.getBalance(static_cast<AccountBook::AccountId>(id)) << "\n";
+    return stats.malformed ? 2 : 0;
+}
+
+/**
+ * ACH entry point: "ach <file> [accounts]" posts a NACHA file into a book of
+ * that many accounts; "ach-sample <file> [batches] [entries per batch]" writes one.
+ */
+int runAch(int argc, char* argv[]) {
+    if (argc < 3) {
+        cout << "Usage: " << argv[1] << " <file> ...\n";
+        return 1;
+    }
+    if (string(argv[1]) == "ach-sample") {
+        size_t batches = argc > 3 ? static_cast<size_t>(stoull(argv[3])) : 100;
+        size_t entries = argc > 4 ? static_cast<size_t>(stoull(argv[4])) : 1000;
+        AchFileProcessor::writeSample(argv[2], batches, entries, 100000);
+        return 0;
+    }
+
+    size_t accounts = argc > 3 ? static_cast<size_t>(stoull(argv[3])) : 100000;
+    int64_t now = static_cast<int64_t>(time(nullptr));
+    AccountBook book;
+    BookMetrics bookMetrics(book);
+    for (size_t id = 0; id < accounts; ++id)
+        book.openAccount(id % 2 ? AccountKind::Checking : AccountKind::Savings, "Account" + to_string(id), 1000, id % 2 ? 500 : 2.5, now);
+
+    AchFileProcessor::Report report = AchFileProcessor::process(argv[2], book, now);
+    cout << "ACH: " << report.batches << " batches (" << report.invalidBatches << " invalid), "
+        << report.posted << " entries posted, " << report.rejected << " rejected, file control "
+        << (report.fileControlValid ? "valid" : "INVALID") << "\n"
+        << fixed << setprecision(2) << "  debits $" << report.debitCents / 100.0 << "  credits $" << report.creditCents / 100.0 << "\n"
+        << "  " << report.bytes / 1e6 << " MB in " << report.seconds * 1e3 << " ms ("
+        << report.bytes / 1e6 / max(report.seconds, 1e-9) << " MB/s)\n";
+    for (const auto& error : report.errors)
+        cout << "  " << error << "\n";
+    return report.invalidBatches == 0 && report.fileControlValid ? 0 : 2;
+}
+
+/**
+ * pain.001 entry point: "pain001 <file> [accounts]" posts a credit transfer file
+ * into a book of that many accounts; "pain001-sample <file> [transactions]" writes one.
+ */
+int runPain001(int argc, char* argv[]) {
+    if (argc < 3) {
+        cout << "Usage: " << argv[1] << " <file> ...\n";
+        return 1;
+    }
+    if (string(argv[1]) == "pain001-sample") {
+        ofstream out(argv[2]);
+        Pain001Processor::writeSample(out, argc > 3 ? static_cast<size_t>(stoull(argv[3])) : 100000, 100000);
+        return 0;
+    }
+
+    size_t accounts = argc > 3 ? static_cast<size_t>(stoull(argv[3])) : 100000;
+    int64_t now = static_cast<int64_t>(time(nullptr));
+    AccountBook book;
+    BookMetrics bookMetrics(book);
+    for (size_t id = 0; id < accounts; ++id)
+        book.openAccount(AccountKind::Checking, "Account" + to_string(id), 1000000, 500, now);
+
+    ifstream in(argv[2], ios::binary);
+    if (!in) {
+        cout << "Cannot open " << argv[2] << "\n";
+        return 1;
+    }
+    Pain001Processor::Report report = Pain001Processor::process(in, book, now);
+    cout << "pain.001: " << report.transactions << " transactions in " << report.batches << " batches, "
+        << report.posted << " posted, " << report.rejected << " rejected, " << report.declined << " declined\n"
+        << fixed << setprecision(2) << "  total $" << report.postedAmount << " in " << report.seconds * 1e3 << " ms ("
+        << setprecision(0) << report.transactions / max(report.seconds, 1e-9) << " txn/s), max queue depth "
+        << report.maxParsedDepth << "/" << report.maxValidatedDepth << "\n";
+    return 0;
+}
+
+/**
+ * Self-test entry point: "test [filter]".
+ */
+int runSelfTests(int argc, char* argv[]) {
+    static const SelfTests::Case cases[] = {
+        { "dormancy scan", testDormancyScan },
+        { "fee cycles", testFeeCycles },
+        { "transfers and graph", testTransfersAndGraph },
+        { "customer rollups", testCustomerRollups },
+        { "account filters", testAccountFilters },
+        { "tpcb driver", testTpcbDriver },
+        { "smallbank driver", testSmallBankDriver },
+        { "workload traces", testWorkloadTraces },
+        { "bulk posting", testBulkPosting },
+        { "ach ingestion", testAchIngestion },
+        { "pain.001 pipeline", testPain001Pipeline },
+        { "product catalog", testProductCatalog },
+        { "reversals", testReversals },
+        { "cash reporting", testCashReporting },
+        { "metrics", testMetrics },
+        { "span tracing", testSpanTracing },
+        { "hardware counters", testHardwareCounters },
+        { "allocation tracking", testAllocationTracking },
+        { "lock profiling", testLockProfiling },
+        { "sampling profiler", testSamplingProfiler },
+        { "policy accounts", testPolicyAccounts },
+        { "command parsing", testCommandParsing },
+        { "instrumentation levels", testInstrumentationLevels },
+        { "c interface", testCoreApi },
+        { "wire format", testWireFormat },
+    };
+    string filter = argc > 2 ? argv[2] : "";
+    size_t run = 0, failed = 0;
+    for (const auto& test : cases) {
+        if (string(test.name).find(filter) == string::npos)
+            continue;
+        ++run;
+        try {
+            test.check();
+            cout << "ok    " << test.name << "\n";
+        }
+        catch (const exception& e) {
+            ++failed;
+            cout << "FAIL  " << test.name << ": " << e.what() << "\n";
+        }
+    }
+    cout << run - failed << " of " << run << " checks passed\n";
+    return failed ? 1 : 0;
+}
+
+/**
  * Entry point: Initializes customers using AccountFactory.
+ * Run with "bench", "tpcb" or "smallbank" as the first argument to run the
+ * benchmark suite or one of the OLTP drivers instead, with "generate" or
+ * "replay" for trace tools, "ach"/"ach-sample" or "pain001"/"pain001-sample"
+ * for payment files, "commands <file>" for a text command stream, or with
+ * "capture <file>" to record this session.
+ * "test [filter]" runs the self-checks and exits non-zero if any fail.
+ * Any of these can be prefixed with "--metrics <file>" to keep a Prometheus
+ * textfile-collector file up to date while it runs, and with "--trace <file>"
+ * to write a Chrome trace-event timeline of the run when it ends. "--profile <file>"
+ * writes sampled folded stacks, at "--profile-hz <rate>" (default 100).
+ * Defining BANKING_CORE_LIBRARY leaves main out, for building the C interface as a library.
  */
-int main() {
+#if !defined(BANKING_CORE_LIBRARY)
+int main(int argc, char* argv[]) {
+    SamplingProfiler::ThreadClass threadName("main");
+    string metricsPath, tracePath, profilePath;
+    int profileHz = 100;
+    while (argc > 2 && string(argv[1]).compare(0, 2, "--") == 0) {
+        string option = argv[1];
+        if (option == "--metrics") metricsPath = argv[2];
+        else if (option == "--trace") tracePath = argv[2];
+        else if (option == "--profile") profilePath = argv[2];
+        else if (option == "--profile-hz") profileHz = stoi(argv[2]);
+        else break;
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
+    unique_ptr<MetricsFileWriter> metricsWriter;
+    unique_ptr<SpanTraceFile> traceFile;
+    unique_ptr<SamplingProfileFile> profileFile;
+    if (!metricsPath.empty()) metricsWriter = make_unique<MetricsFileWriter>(metricsPath);
+    if (!tracePath.empty()) traceFile = make_unique<SpanTraceFile>(tracePath);
+    if (!profilePath.empty()) profileFile = make_unique<SamplingProfileFile>(profilePath, profileHz);
+    if (argc > 1 && string(argv[1]) == "bench")
+        return runBenchmarks(argc, argv);
+    if (argc > 1 && string(argv[1]) == "test")
+        return runSelfTests(argc, argv);
+    if (argc > 1 && string(argv[1]) == "tpcb")
+        return runTpcb(argc, argv);
+    if (argc > 1 && string(argv[1]) == "smallbank")
+        return runSmallBank(argc, argv);
+    if (argc > 1 && (string(argv[1]) == "generate" || string(argv[1]) == "replay"))
+        return runTraceTool(argc, argv);
+    if (argc > 1 && (string(argv[1]) == "ach" || string(argv[1]) == "ach-sample"))
+        return runAch(argc, argv);
+    if (argc > 1 && string(argv[1]) == "commands")
+        return runCommands(argc, argv);
+    if (argc > 1 && (string(argv[1]) == "pain001" || string(argv[1]) == "pain001-sample"))
+        return runPain001(argc, argv);
+
     CustomerList customers;
     customers.addCustomer(AccountFactory::createAccount("savings", "Laurie", 5000, 2.5));
     customers.addCustomer(AccountFactory::createAccount("checking", "Larry", 1000, 500));
     customers.addCustomer(AccountFactory::createAccount("savings", "David", 10000, 2.5));
     customers.addCustomer(AccountFactory::createAccount("checking", "Luis", 2000, 500));
 
+    if (argc > 2 && string(argv[1]) == "capture") {
+        TraceRecorder recorder;
+        performBankingOperations(customers, &recorder);
+        recorder.getTrace().save(argv[2]);
+        return 0;
+    }
     performBankingOperations(customers);
     return 0;
-}
\ No newline at end of file
+}
+#endif